@@ -0,0 +1,22 @@
+#!/bin/bash
+
+# Confronta i motori di I/O del server (epoll e io_uring),
+# con uno o più event loop, sullo stesso carico.
+
+CONN=${1:-64}; MSG=${2:-2000}; LOOPS=$(nproc)
+
+for engine in epoll uring; do
+	for loops in $(echo 1 $LOOPS | tr ' ' '\n' | sort -un); do
+
+		echo -n "engine=$engine loops=$loops "
+		OOB_SERVER_ENGINE=$engine OOB_SERVER_LOOPS=$loops bin/bench $CONN $MSG
+	done
+done
+
+# Confronta le implementazioni della coda del threadpool.
+
+for queue in mutex lockfree stealing; do
+	bin/poolbench $queue $LOOPS 2 200000
+	bin/poolbench $queue 4 4 100000
+	bin/poolbench $queue 4 1 20000 15
+done
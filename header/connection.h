@@ -12,13 +12,19 @@
 #ifndef CONNECTION_H_
 #define CONNECTION_H_
 
+#include <stdint.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
 #define UNIX_PATH_MAX 108
-#define MAX_RETRY 3
-#define SLEEP_TIME 2
+#define RETRY_MIN_MS 1 // Prima attesa tra due tentativi di connessione, poi raddoppiata...
+#define RETRY_MAX_MS 500 // ...fino a questo valore.
+#define RETRY_TIMEOUT_MS 6000 // Attesa complessiva oltre la quale il client rinuncia.
+
+#define CONTROL_SOCKET "OOB-supervisor" // Socket di controllo del supervisor, di default.
+#define AGGREGATOR_SOCKET "OOB-aggregator" // Socket dell'aggregatore radice, di default.
 
 typedef struct sockaddr_un Address_t;
 
@@ -26,4 +32,108 @@ typedef struct sockaddr_un Address_t;
     strncpy(addr.sun_path, sockname, UNIX_PATH_MAX);    \
     addr.sun_family = AF_UNIX
 
+/**
+ * Protocollo tra client e server: il client invia frame binari di 
+ * dimensione fissa FRAME_SIZE, con i campi in network byte order:
+ *
+ *   | id (8 byte) | seq (4 byte) | flags (4 byte) | send_ts (8 byte) |
+ *
+ * Essendo la dimensione fissa, il server può decodificare tutti i
+ * frame contenuti in una read senza alcuna conversione da stringa,
+ * anche quando più frame arrivano accorpati.
+ */
+#define FRAME_SIZE 24
+
+#define FRAME_F_TIMESTAMP 0x1 // Il campo send_ts è valorizzato.
+
+/**
+ * @struct Frame_t
+ */
+typedef struct {
+
+    uint64_t id;        /**< Id del client. */
+    uint32_t seq;       /**< Numero di sequenza del messaggio. */
+    uint32_t flags;     /**< Combinazione di FRAME_F_*. */
+    uint64_t send_ts;   /**< Istante di invio (CLOCK_MONOTONIC, ns), se FRAME_F_TIMESTAMP. */
+
+} Frame_t;
+
+/**
+ * @function frame_encode
+ * @brief Scrive in @buf, che deve essere lungo almeno 
+ *        FRAME_SIZE byte, la codifica di @frame.
+ */
+void frame_encode(char* buf, const Frame_t* frame);
+
+/**
+ * @function frame_decode
+ * @brief Decodifica in @frame i primi FRAME_SIZE byte di @buf.
+ */
+void frame_decode(const char* buf, Frame_t* frame);
+
+/**
+ * Protocollo tra server e supervisor: record binari di dimensione fissa
+ * ESTIMATE_SIZE, nell'ordine dei byte della macchina (i due processi
+ * girano sullo stesso host):
+ *
+ *   | id (8 byte) | stima (4 byte) |
+ *
+ * Il server li scrive a blocchi di al più ESTIMATE_BATCH byte: una write
+ * su una pipe di al più PIPE_BUF byte è atomica, quindi i blocchi di
+ * thread diversi non si mescolano, e il supervisor può decodificare
+ * tutti i record letti con una sola read.
+ */
+#define ESTIMATE_SIZE 12
+
+#ifndef PIPE_BUF
+#define PIPE_BUF 512 // Minimo garantito da POSIX, se limits.h non lo espone.
+#endif
+
+#define ESTIMATE_BATCH ((PIPE_BUF / ESTIMATE_SIZE) * ESTIMATE_SIZE)
+
+/**
+ * @function estimate_encode
+ * @brief Scrive in @buf, che deve essere lungo almeno ESTIMATE_SIZE
+ *        byte, il record della stima @stima per il client @id.
+ */
+void estimate_encode(char* buf, int64_t id, int32_t stima);
+
+/**
+ * @function estimate_decode
+ * @brief Decodifica i primi ESTIMATE_SIZE byte di @buf.
+ */
+void estimate_decode(const char* buf, int64_t* id, int32_t* stima);
+
+/**
+ * Primo record che ogni server invia al supervisor, non appena accetta
+ * connessioni: l'id non è mai quello di un client, la stima è l'id del server.
+ */
+#define ESTIMATE_READY (-1)
+
+/**
+ * Protocollo tra i supervisor e l'aggregatore radice: ogni supervisor
+ * invia periodicamente, per i client con nuove stime, record di dimensione
+ * fissa DELTA_SIZE in network byte order (i supervisor possono girare su
+ * host diversi):
+ *
+ *   | id (8 byte) | stima minima (4 byte) | numero di stime (4 byte) |
+ *
+ * Il record riassume solo le stime ricevute dall'invio precedente:
+ * l'aggregatore lo fonde con minimo e somma, in qualunque ordine.
+ */
+#define DELTA_SIZE 16
+
+/**
+ * @function delta_encode
+ * @brief Scrive in @buf, che deve essere lungo almeno DELTA_SIZE byte,
+ *        il record di @count stime per il client @id, la migliore @stima.
+ */
+void delta_encode(char* buf, int64_t id, int32_t stima, int32_t count);
+
+/**
+ * @function delta_decode
+ * @brief Decodifica i primi DELTA_SIZE byte di @buf.
+ */
+void delta_decode(const char* buf, int64_t* id, int32_t* stima, int32_t* count);
+
 #endif //CONNECTION_H_
@@ -13,6 +13,7 @@
 
 #include <utils.h>
 #include <limits.h>
+#include <pthread.h>
 
 /**
  * @struct Entry_t
@@ -26,15 +27,41 @@ typedef struct {
 		int count_server;
 	} value;
 
+	uint64_t last;          /**< Istante (ms, CLOCK_MONOTONIC) dell'ultimo aggiornamento. */
+	int dirty;              /**< Posizione (+1) nella lista delle entry modificate, 0 se non modificata. */
+
 } Entry_t;
 
+#define DICT_GROUP 16 // Slot dell'indice confrontati insieme durante la ricerca.
+#define DICT_EMPTY 0x80 // Byte di controllo di uno slot libero.
+#define DICT_DELETED 0xfe // Byte di controllo di uno slot la cui chiave è stata rimossa.
+
+/**
+ * Funzione a cui evict passa ogni entry rimossa, prima di rimuoverla.
+ */
+typedef void (*dict_archive_t)(const Entry_t* entry, void* arg);
+
 /**
  * @struct Dict_t
+ * @brief Le entry sono memorizzate in modo compatto, in ordine di inserimento,
+ *        e si trovano tramite un indice hash ad indirizzamento aperto:
+ *        per ogni slot dell'indice un byte di controllo contiene 7 bit
+ *        dell'hash della chiave (o DICT_EMPTY), così la ricerca confronta
+ *        un gruppo di DICT_GROUP slot alla volta senza leggere le entry.
  */
 typedef struct {
-    
+
 	int len;        /**< Lunghezza del dizionario. */
-    Entry_t* entry; /**< Array, allocato dinamicamente, di Entry_t. */
+	Entry_t* entry; /**< Array, allocato dinamicamente, di Entry_t. */
+	int size;       /**< Entry allocate, raddoppiate quando non bastano. */
+
+	int mask;               /**< Numero di slot dell'indice meno uno. */
+	unsigned char* ctrl;    /**< Byte di controllo degli slot. */
+	int* slot;              /**< Posizione in entry della chiave di ogni slot. */
+	int used;               /**< Slot non liberi, compresi quelli cancellati. */
+
+	int* dirty;             /**< Posizioni in entry delle entry modificate dall'ultimo clean. */
+	int ndirty, dirty_size;
 
 } Dict_t;
 
@@ -42,6 +69,14 @@ typedef struct {
 	for (int i = 0; i < dict->len; i++) 	\
 		for (key = dict->entry[i].key, value = dict->entry[i].value; key == dict->entry[i].key; key++)
 
+/**
+ * Come foreach, ma solo sulle entry aggiunte o modificate dall'ultimo clean
+ * (quelle rimosse nel frattempo non compaiono).
+ */
+#define foreach_dirty(dict, key, value) 	\
+	for (int i = 0; i < dict->ndirty; i++) 	\
+		for (key = dict->entry[dict->dirty[i]].key, value = dict->entry[dict->dirty[i]].value; key == dict->entry[dict->dirty[i]].key; key++)
+
 /**
  * @function initDict
  * @brief Restituisce un puntatore ad un oggetto Dict_t 
@@ -70,4 +105,178 @@ void add(Dict_t* dict, long long int key, struct value_t value);
  */
 struct value_t get_value(Dict_t* dict, long long int key);
 
+/**
+ * @function merge
+ * @brief Riporta in @dict @count stime per @key, la migliore delle quali è
+ *        @stima: miglior_stima diventa il minimo tra le due, count_server
+ *        la somma. Una chiave assente viene aggiunta con il valore {@stima, @count}.
+ *        Minimo e somma non dipendono dall'ordine: i valori di tabelle
+ *        diverse si possono fondere in qualunque ordine.
+ * @return Il valore dopo l'aggiornamento.
+ */
+struct value_t merge(Dict_t* dict, long long int key, int stima, int count);
+
+/**
+ * @function clean
+ * @brief Segna tutte le entry di @dict come non modificate, ad esempio
+ *        dopo averle stampate: foreach_dirty vedrà solo le successive modifiche.
+ */
+void clean(Dict_t* dict);
+
+/**
+ * @function evict
+ * @brief Rimuove da @dict le entry non aggiornate da più di @ttl_ms
+ *        millisecondi (nessuna se @ttl_ms <= 0); poi, se restano più di
+ *        @cap entry (nessun limite se @cap <= 0), le meno recenti fino a
+ *        scendere a 7/8 di @cap. Ogni entry rimossa viene prima passata
+ *        ad @archive, se non è NULL.
+ * @return Numero di entry rimosse.
+ *
+ * NOTE: l'entry rimossa viene sostituita dall'ultima, quindi l'ordine
+ *       di foreach non è più quello di inserimento.
+ */
+int evict(Dict_t* dict, long ttl_ms, int cap, dict_archive_t archive, void* arg);
+
+#define DICT_SNAPSHOT_MAGIC "OOBDICT1"
+#define DICT_SNAPSHOT_VERSION 2
+
+/**
+ * @struct DictSnapshot_t
+ * @brief Intestazione di uno snapshot di Dict_t, seguita da len record
+ *        Entry_t così come sono in memoria (ordine dei byte della macchina).
+ */
+typedef struct {
+
+	char magic[8];          /**< DICT_SNAPSHOT_MAGIC. */
+	uint32_t version;       /**< DICT_SNAPSHOT_VERSION. */
+	uint32_t entry_size;    /**< sizeof(Entry_t) di chi ha scritto lo snapshot. */
+	uint64_t len;           /**< Numero di entry. */
+	uint64_t checksum;      /**< Checksum delle entry, vedi saveDict. */
+
+} DictSnapshot_t;
+
+/**
+ * @function saveDict
+ * @brief Scrive in @path uno snapshot di @dict: un file piatto, mappabile
+ *        in memoria, con l'intestazione DictSnapshot_t seguita dalle entry.
+ *        Lo snapshot viene scritto in un file temporaneo e poi rinominato,
+ *        quindi @path contiene sempre uno snapshot completo.
+ * @return 0 successo, -1 altrimenti.
+ */
+int saveDict(Dict_t* dict, const char* path);
+
+/**
+ * @function loadDict
+ * @brief Mappa in memoria lo snapshot @path e ne ricostruisce il Dict_t,
+ *        dopo averne verificato intestazione e checksum. L'istante
+ *        dell'ultimo aggiornamento di ogni entry riparte da quello corrente.
+ * @return Il dizionario, NULL se lo snapshot non esiste (errno a ENOENT)
+ *         o non è valido (errno a EINVAL).
+ */
+Dict_t* loadDict(const char* path);
+
+/**
+ * @struct CDict_t
+ * @brief Variante concorrente del dizionario: le chiavi sono ripartite
+ *        in shard, ognuno con il proprio Dict_t e il proprio rwlock.
+ *        Gli aggiornamenti di chiavi già presenti avvengono con il solo
+ *        lock in lettura, quindi in parallelo anche sullo stesso shard.
+ */
+typedef struct {
+
+	struct cdict_shard_t {
+		pthread_rwlock_t lock;
+		Dict_t* dict;
+		char pad[64];       /**< Tiene i lock di shard diversi su linee di cache diverse. */
+	}* shard;
+
+	int nshards;            /**< Numero di shard (potenza di due). */
+
+} CDict_t;
+
+/**
+ * Come foreach, su tutti gli shard: va usata solo quando nessun thread
+ * sta modificando @cdict.
+ */
+#define cforeach(cdict, key, value) \
+	for (int s = 0; s < (cdict)->nshards; s++) \
+		foreach((cdict)->shard[s].dict, key, value)
+
+/**
+ * @function initCDict
+ * @brief Restituisce un puntatore ad un oggetto CDict_t allocato
+ *        dinamicamente, con almeno @nshards shard (uno per CPU se @nshards <= 0).
+ */
+CDict_t* initCDict(int nshards);
+
+/**
+ * @function deleteCDict
+ * @brief Distrugge l'oggetto @cdict, liberando tutta la memoria occupata.
+ */
+void deleteCDict(CDict_t* cdict);
+
+/**
+ * @function cdict_add
+ * @brief Come add, in modo thread-safe.
+ */
+void cdict_add(CDict_t* cdict, long long int key, struct value_t value);
+
+/**
+ * @function cdict_get_value
+ * @brief Come get_value, in modo thread-safe.
+ */
+struct value_t cdict_get_value(CDict_t* cdict, long long int key);
+
+/**
+ * @function cdict_update
+ * @brief Aggiorna atomicamente il valore associato a @key con una nuova
+ *        stima: miglior_stima diventa il minimo tra la precedente e @stima
+ *        e count_server viene incrementato. Una chiave assente viene
+ *        aggiunta con il valore {@stima, 1}. Solo la prima modifica di
+ *        una entry dopo un clean richiede il lock in scrittura.
+ * @return Il valore dopo l'aggiornamento.
+ */
+struct value_t cdict_update(CDict_t* cdict, long long int key, int stima);
+
+/**
+ * @function cdict_merge
+ * @brief Come merge, in modo thread-safe: cdict_update equivale a
+ *        cdict_merge con @count 1.
+ */
+struct value_t cdict_merge(CDict_t* cdict, long long int key, int stima, int count);
+
+/**
+ * @function cdict_drain
+ * @brief Svuota @cdict, uno shard alla volta, passando poi ad @fn tutte le
+ *        entry che conteneva. Lo shard viene sostituito da uno vuoto con il
+ *        lock in scrittura, @fn viene chiamata senza alcun lock: le entry
+ *        aggiunte nel frattempo restano per la chiamata successiva.
+ * @return Numero di entry passate ad @fn, -1 in caso di errore.
+ */
+int cdict_drain(CDict_t* cdict, dict_archive_t fn, void* arg);
+
+/**
+ * @function cdict_evict
+ * @brief Come evict, uno shard alla volta: il limite @cap viene ripartito
+ *        in parti uguali tra gli shard. @archive viene chiamata con il
+ *        lock dello shard acquisito.
+ * @return Numero di entry rimosse.
+ */
+int cdict_evict(CDict_t* cdict, long ttl_ms, int cap, dict_archive_t archive, void* arg);
+
+/**
+ * @function saveCDict
+ * @brief Come saveDict, per tutti gli shard di @cdict: ogni shard viene
+ *        copiato con il proprio lock in lettura, il file scritto senza lock.
+ * @return 0 successo, -1 altrimenti.
+ */
+int saveCDict(CDict_t* cdict, const char* path);
+
+/**
+ * @function loadCDict
+ * @brief Come loadDict, ripartendo le entry dello snapshot in @nshards shard.
+ * @return Il dizionario, NULL come per loadDict.
+ */
+CDict_t* loadCDict(const char* path, int nshards);
+
 #endif // DICT_H_
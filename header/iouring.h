@@ -0,0 +1,142 @@
+/**
+ * @file iouring.h
+ * @brief Interfaccia minimale verso io_uring, usata dal server
+ *        come motore di I/O alternativo alla epoll.
+ *
+ * @author Alessio Bardelli 544270
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore
+ */
+
+#ifndef IOURING_H_
+#define IOURING_H_
+
+#include <utils.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
+
+// Il motore usa i buffer registrati (IORING_REGISTER_PBUF_RING, kernel 5.19),
+// la recv multishot (kernel 6.0) e i timeout di io_uring_enter (kernel 5.11):
+// con header più vecchi il server usa soltanto la epoll. IORING_REGISTER_PBUF_RING
+// è un enumerativo e non si può controllare con il preprocessore: la coprono
+// IORING_ACCEPT_MULTISHOT, introdotta con esso, e IORING_RECV_MULTISHOT.
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_ACCEPT_MULTISHOT) && defined(IORING_ENTER_EXT_ARG)
+#define HAVE_IO_URING
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <stdint.h>
+
+/**
+ * @struct Uring_t
+ * @brief Istanza io_uring con le code di submission e completion
+ *        mappate in memoria.
+ */
+typedef struct {
+
+    int fd;                         /**< File descriptor dell'istanza io_uring. */
+
+    unsigned *sq_head, *sq_tail;    /**< Indici della submission queue (condivisi con il kernel). */
+    unsigned *sq_array, sq_mask;    /**< Array di indirizzamento delle sqe e relativa maschera. */
+    unsigned sq_entries, sq_local;  /**< Dimensione della coda e tail locale non ancora pubblicata. */
+    struct io_uring_sqe* sqes;      /**< Array delle submission queue entry. */
+
+    unsigned *cq_head, *cq_tail;    /**< Indici della completion queue (condivisi con il kernel). */
+    unsigned cq_mask;               /**< Maschera della completion queue. */
+    struct io_uring_cqe* cqes;      /**< Array delle completion queue entry. */
+
+    void *sq_ptr, *cq_ptr;          /**< Zone di memoria mappate, da liberare in uring_exit. */
+    size_t sq_sz, cq_sz, sqes_sz;   /**< Dimensioni delle zone mappate. */
+
+} Uring_t;
+
+/**
+ * @struct UringBufs_t
+ * @brief Anello di buffer forniti al kernel (provided buffer ring):
+ *        le recv multishot vi scelgono il buffer in cui scrivere.
+ */
+typedef struct {
+
+    struct io_uring_buf_ring* br;   /**< Anello condiviso con il kernel. */
+    char* bufs;                     /**< Memoria dei buffer, contigua. */
+    unsigned entries, bufsize;      /**< Numero e dimensione dei buffer. */
+    unsigned short bgid;            /**< Identificatore del gruppo di buffer. */
+
+} UringBufs_t;
+
+/**
+ * @function uring_init
+ * @brief Crea un'istanza io_uring con @entries submission entry.
+ * @return 0 successo, -1 altrimenti (errno impostato).
+ */
+int uring_init(Uring_t* ring, unsigned entries);
+
+/**
+ * @function uring_exit
+ * @brief Distrugge l'istanza, cancellando tutte le richieste pendenti.
+ */
+void uring_exit(Uring_t* ring);
+
+/**
+ * @function uring_get_sqe
+ * @brief Restituisce una sqe azzerata, o NULL se la coda è piena
+ *        (in tal caso occorre prima chiamare uring_submit_and_wait).
+ */
+struct io_uring_sqe* uring_get_sqe(Uring_t* ring);
+
+/**
+ * @function uring_submit_and_wait
+ * @brief Pubblica le sqe preparate e attende almeno @wait_nr completamenti,
+ *        per al più @timeout_ms millisecondi.
+ * @return numero di sqe consumate dal kernel, -1 in caso di errore
+ *         (ETIME e EINTR non sono considerati errori).
+ */
+int uring_submit_and_wait(Uring_t* ring, unsigned wait_nr, int timeout_ms);
+
+/**
+ * @function uring_peek_cqe
+ * @brief Restituisce il primo completamento disponibile, o NULL.
+ *        Dopo averlo gestito occorre chiamare uring_cqe_seen.
+ */
+struct io_uring_cqe* uring_peek_cqe(Uring_t* ring);
+
+/**
+ * @function uring_cqe_seen
+ * @brief Restituisce al kernel lo slot del completamento corrente.
+ */
+void uring_cqe_seen(Uring_t* ring);
+
+/**
+ * @function uring_bufs_init
+ * @brief Alloca @entries buffer di @bufsize byte e li registra
+ *        come gruppo @bgid dell'istanza @ring.
+ *        @entries deve essere una potenza di due.
+ * @return 0 successo, -1 altrimenti.
+ */
+int uring_bufs_init(Uring_t* ring, UringBufs_t* bufs, unsigned short bgid, unsigned entries, unsigned bufsize);
+
+/**
+ * @function uring_bufs_get
+ * @brief Restituisce l'indirizzo del buffer @bid.
+ */
+#define uring_bufs_get(b, bid) ((b)->bufs + (size_t)(bid) * (b)->bufsize)
+
+/**
+ * @function uring_bufs_recycle
+ * @brief Restituisce al kernel il buffer @bid, una volta consumato.
+ */
+void uring_bufs_recycle(UringBufs_t* bufs, unsigned short bid);
+
+/**
+ * @function uring_bufs_exit
+ * @brief Deregistra il gruppo di buffer e libera la memoria.
+ */
+void uring_bufs_exit(Uring_t* ring, UringBufs_t* bufs);
+
+#endif // HAVE_IO_URING
+
+#endif // IOURING_H_
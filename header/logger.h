@@ -0,0 +1,68 @@
+/**
+ * @file logger.h
+ * @brief Interfaccia del logger asincrono: i thread scrivono record
+ *        binari in un buffer circolare privato (SPSC), un thread in
+ *        background li formatta e li scrive a blocchi.
+ *
+ * @author Alessio Bardelli 544270
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore
+ */
+
+#ifndef LOGGER_H_
+#define LOGGER_H_
+
+#include <utils.h>
+#include <pthread.h>
+
+#define LOG_RING_SIZE 4096 // Record per thread (potenza di due).
+#define LOG_BATCH_SIZE 65536 // Byte formattati prima di effettuare una write.
+
+/**
+ * Flag di un record: destinazione e possibilità di scartarlo.
+ */
+#define LOG_STDOUT    0x0
+#define LOG_STDERR    0x1
+#define LOG_SHEDDABLE 0x2 // Il record può essere scartato o campionato sotto carico.
+
+/**
+ * @function logger_init
+ * @brief Avvia il thread che scrive i record. La politica per i record
+ *        LOG_SHEDDABLE si legge dalle variabili d'ambiente:
+ *          OOB_LOG_SAMPLE=N  scrive un record ogni N (default 1, tutti);
+ *          OOB_LOG_DROP=1    li scarta se il buffer del thread è pieno,
+ *                            invece di attendere che si liberi.
+ *        Prima di logger_init (e dopo logger_exit) i record sono
+ *        scritti direttamente, in modo sincrono.
+ * @return 0 successo, -1 altrimenti.
+ */
+int logger_init();
+
+/**
+ * @function logger_write
+ * @brief Accoda un record formattato con @fmt e i 4 argomenti interi:
+ *        il formato deve quindi usare solo conversioni per long
+ *        (%ld, %lx, ...) e deve essere una stringa costante, perché
+ *        viene formattato più tardi dal thread del logger.
+ *        Un record non LOG_SHEDDABLE non viene mai perso: se il buffer
+ *        è pieno il chiamante attende.
+ */
+void logger_write(int flags, const char* fmt, long a, long b, long c, long d);
+
+/**
+ * @function logger_flush
+ * @brief Attende che tutti i record accodati fino ad ora siano stati scritti,
+ *        per poter scrivere direttamente sugli stessi file mantenendo l'ordine.
+ */
+void logger_flush();
+
+/**
+ * @function logger_exit
+ * @brief Scrive i record pendenti, termina il thread e libera la memoria.
+ */
+void logger_exit();
+
+#define LOG(fmt, a, b, c, d) logger_write(LOG_STDOUT, fmt, (long)(a), (long)(b), (long)(c), (long)(d))
+
+#endif // LOGGER_H_
@@ -0,0 +1,115 @@
+/**
+ * @file shmring.h
+ * @brief Interfaccia del buffer circolare in memoria condivisa con cui
+ *        un server consegna le stime al supervisor: i thread del server
+ *        sono i produttori, il supervisor l'unico consumatore (MPSC).
+ *        La memoria è un memfd ereditato dal server attraverso la exec,
+ *        la notifica un eventfd, scritto solo se il supervisor è in attesa.
+ *
+ * @author Alessio Bardelli 544270
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore
+ */
+
+#ifndef SHMRING_H_
+#define SHMRING_H_
+
+#include <utils.h>
+#include <stdint.h>
+
+#define SHMRING_SIZE 4096 // Record per buffer (potenza di due).
+#define SHMRING_POLL_MS 10 // Attesa sulla futex prima di ricontrollare il consumatore.
+
+/**
+ * @struct ShmCell_t
+ * @brief Record di una stima: seq dice a chi appartiene la cella
+ *        (uguale alla posizione se libera, alla posizione + 1 se piena).
+ */
+typedef struct {
+
+    uint64_t seq;
+    int64_t id;         /**< Id del client. */
+    int32_t stima;      /**< Stima del secret, in ms. */
+    int32_t pad;
+
+} ShmCell_t;
+
+/**
+ * @struct ShmRing_t
+ * @brief Buffer circolare, mappato allo stesso modo da server e supervisor.
+ */
+typedef struct {
+
+    uint64_t size;              /**< Numero di celle (potenza di due). */
+    char pad0[56];
+    uint64_t tail;              /**< Prossima cella da riservare (produttori). */
+    char pad1[56];
+    uint64_t head;              /**< Prossima cella da leggere (consumatore). */
+    int waiting;                /**< Il consumatore attende una notifica. */
+    int space;                  /**< Futex: incrementata quando si libera una cella. */
+    int blocked;                /**< Produttori in attesa di spazio. */
+    int closed;                 /**< Il consumatore non estrae più stime. */
+    int32_t consumer;           /**< Pid del consumatore. */
+    char pad2[36];
+
+    ShmCell_t cell[];
+
+} ShmRing_t;
+
+/**
+ * @function shmring_create
+ * @brief Crea un buffer di @size celle in un memfd, il cui file descriptor
+ *        (ereditabile) viene scritto in @memfd.
+ * @return Il buffer mappato in memoria, NULL in caso di errore.
+ */
+ShmRing_t* shmring_create(int size, int* memfd);
+
+/**
+ * @function shmring_attach
+ * @brief Mappa in memoria il buffer contenuto nel memfd @memfd.
+ * @return Il buffer, NULL in caso di errore.
+ */
+ShmRing_t* shmring_attach(int memfd);
+
+/**
+ * @function shmring_detach
+ * @brief Rimuove il buffer dalla memoria del processo.
+ */
+void shmring_detach(ShmRing_t* ring);
+
+/**
+ * @function shmring_close
+ * @brief Segnala ai produttori che il consumatore non estrae più stime,
+ *        svegliando quelli in attesa di spazio.
+ */
+void shmring_close(ShmRing_t* ring);
+
+/**
+ * @function shmring_push
+ * @brief Accoda una stima, attendendo al più @timeout_ms (-1 senza limite)
+ *        che si liberi spazio se il buffer è pieno, e la notifica sull'eventfd
+ *        @efd se il consumatore è in attesa. L'attesa si interrompe se il
+ *        consumatore termina o chiude il buffer.
+ *        Può essere chiamata da più thread contemporaneamente.
+ * @return 0 successo, -1 con errno EPIPE se il consumatore non c'è più,
+ *         ETIMEDOUT se il buffer è rimasto pieno.
+ */
+int shmring_push(ShmRing_t* ring, int efd, long long int id, int stima, long timeout_ms);
+
+/**
+ * @function shmring_pop
+ * @brief Estrae la prossima stima, se presente. Solo il consumatore la chiama.
+ * @return 1 se è stata estratta una stima, 0 se il buffer è vuoto.
+ */
+int shmring_pop(ShmRing_t* ring, long long int* id, int* stima);
+
+/**
+ * @function shmring_wait
+ * @brief Segnala che il consumatore, svuotato il buffer, sta per attendere
+ *        sull'eventfd. Se nel frattempo è arrivata una stima l'attesa è annullata.
+ * @return 0 se il consumatore può attendere, 1 se deve prima svuotare di nuovo il buffer.
+ */
+int shmring_wait(ShmRing_t* ring);
+
+#endif // SHMRING_H_
@@ -15,8 +15,10 @@
 #include <unistd.h>
 #include <utils.h>
 
-#define MAX_THREADS 64
+#define MAX_THREADS 64 // Worker avviati alla creazione; un pool elastico può crescere oltre.
 #define MAX_QUEUE 65536
+#define THREADPOOL_MAX_CPUS 1024 // CPU considerate dalle politiche di affinità.
+#define THREADPOOL_HIST_BUCKETS 40 // Bucket degli istogrammi: fino a 2^40 ns, circa 18 minuti.
 
 typedef struct threadpool_t threadpool_t;
 
@@ -32,14 +34,137 @@ typedef enum {
 
 } threadpool_destroy_flags_t;
 
+/**
+ * @enum threadpool_queue_t
+ * @brief Implementazione della coda dei task.
+ *
+ *  threadpool_queue_mutex:    array circolare protetto da un mutex,
+ *                             i worker inattivi attendono su una condition variable;
+ *  threadpool_queue_lockfree: coda limitata MPMC senza lock (numeri di sequenza
+ *                             per cella, alla Vyukov), i worker inattivi
+ *                             attendono su una futex;
+ *  threadpool_queue_stealing: work stealing: ogni worker ha una deque di
+ *                             Chase-Lev in cui finiscono i task sottomessi dal
+ *                             worker stesso, quelli sottomessi dall'esterno passano
+ *                             per una coda lockfree condivisa; un worker senza task
+ *                             li ruba dalle deque di worker scelti a caso.
+ */
+typedef enum {
+
+    threadpool_queue_mutex = 0,
+    threadpool_queue_lockfree = 1,
+    threadpool_queue_stealing = 2
+
+} threadpool_queue_t;
+
+/**
+ * @enum threadpool_affinity_t
+ * @brief Politica di assegnamento dei worker alle CPU su cui il processo
+ *        può girare; il worker dello slot i va sulla CPU i-esima (modulo
+ *        il loro numero) nell'ordine dato dalla politica.
+ *
+ *  threadpool_affinity_none:    nessun vincolo, decide lo scheduler;
+ *  threadpool_affinity_compact: CPU vicine: prima i thread hardware dello
+ *                               stesso core, poi i core dello stesso nodo NUMA;
+ *  threadpool_affinity_scatter: CPU lontane: un core per nodo NUMA a rotazione,
+ *                               i thread hardware gemelli soltanto per ultimi;
+ *  threadpool_affinity_list:    le CPU elencate in threadpool_attr_t.cpus.
+ */
+typedef enum {
+
+    threadpool_affinity_none = 0,
+    threadpool_affinity_compact = 1,
+    threadpool_affinity_scatter = 2,
+    threadpool_affinity_list = 3
+
+} threadpool_affinity_t;
+
+/**
+ * @typedef threadpool_reject_t
+ * @brief Funzione invocata con ogni task che il threadpool rifiuta, in modo
+ *        che chi lo ha sottomesso possa liberarne le risorse (ad esempio
+ *        chiudere il file descriptor passato come argomento).
+ * @param error EAGAIN coda piena, ETIMEDOUT attesa scaduta,
+ *              ECANCELED threadpool in terminazione.
+ */
+typedef void (*threadpool_reject_t) (void (*routine) (void*), void* arg, int error);
+
+/**
+ * @struct threadpool_attr_t
+ * @brief Parametri di creazione del threadpool.
+ */
+typedef struct {
+
+    int thread_count;           /**< Numero di thread worker, 0 uno per CPU. */
+    int queue_size;             /**< Dimensione della coda. */
+    threadpool_queue_t queue;   /**< Implementazione della coda. */
+    threadpool_reject_t reject; /**< Funzione per i task rifiutati, NULL se assente. */
+    int min_threads;            /**< Worker che non si ritirano mai (al più thread_count, negativo thread_count). */
+    int max_threads;            /**< Worker massimi sotto carico (almeno thread_count). */
+    long idle_timeout_ms;       /**< Inattività dopo cui un worker oltre il minimo si ritira, 0 mai. */
+    long spawn_wait_ms;         /**< Attesa in coda di un task oltre cui si aggiunge un worker, 0 mai. */
+    boolean stats;              /**< true per raccogliere task sottomessi e istogrammi dei tempi. */
+    threadpool_affinity_t affinity; /**< Politica di affinità dei worker. */
+    const int* cpus;            /**< CPU per threadpool_affinity_list (copiate alla creazione). */
+    int ncpus;                  /**< Lunghezza di @cpus. */
+
+} threadpool_attr_t;
+
+/**
+ * @struct threadpool_stats_t
+ * @brief Statistiche di un threadpool, lette da threadpool_stats.
+ *        Gli istogrammi sono in scala logaritmica: il bucket i conta
+ *        le durate in [2^i, 2^(i+1)) nanosecondi.
+ */
+typedef struct {
+
+    int threads;                /**< Worker attivi. */
+    int idle;                   /**< Worker in attesa di un task. */
+    long queued;                /**< Task in coda (anche nelle deque, con il work stealing). */
+    long peak_queued;           /**< Massimo numero di task in una coda osservato. */
+    unsigned long submitted;    /**< Task accettati (solo con stats). */
+    unsigned long completed;    /**< Task eseguiti. */
+    unsigned long rejected;     /**< Task rifiutati: coda piena, timeout o terminazione. */
+
+    unsigned long wait_hist[THREADPOOL_HIST_BUCKETS];   /**< Attesa in coda (solo con stats). */
+    unsigned long run_hist[THREADPOOL_HIST_BUCKETS];    /**< Durata dei task (solo con stats). */
+
+} threadpool_stats_t;
+
+/**
+ * @function threadpool_attr_init
+ * @brief Inizializza @attr con i valori di default: coda con mutex,
+ *        nessuna funzione di rifiuto, numero di worker fisso
+ *        (min_threads = max_threads = thread_count), nessuna affinità.
+ *
+ * NOTE: con max_threads > min_threads il pool è elastico: aggiunge un
+ *       worker quando nessuno è inattivo e in coda ci sono almeno tanti
+ *       task quanti worker, o un task ha atteso più di spawn_wait_ms
+ *       (default 10); con idle_timeout_ms > 0 i worker oltre il minimo
+ *       restati inattivi così a lungo si ritirano. Con min_threads 0
+ *       possono ritirarsi tutti: il primo task sottomesso ne riavvia uno.
+ *       Le statistiche sui tempi sono disattivate di default:
+ *       costano due letture dell'orologio per task.
+ */
+void threadpool_attr_init(threadpool_attr_t* attr, int thread_count, int queue_size);
+
 /**
  * @function threadpool_create
  * @brief Crea e restituisce un threadpool correttamente inizializzato.
- * @param thread_count Numero di thread worker.
+ * @param thread_count Numero di thread worker, 0 uno per CPU su cui
+ *                     il processo può girare (al più MAX_THREADS).
  * @param queue_size   Dimensione della coda.
  */
 threadpool_t* threadpool_create(int thread_count, int queue_size);
 
+/**
+ * @function threadpool_create_attr
+ * @brief Come threadpool_create, con i parametri specificati da @attr.
+ *        Con la coda lockfree la dimensione viene arrotondata
+ *        alla potenza di due successiva.
+ */
+threadpool_t* threadpool_create_attr(const threadpool_attr_t* attr);
+
 /**
  * @function threadpool_add
  * @brief Aggiunge un nuovo task nella coda del threadpool.
@@ -47,9 +172,112 @@ threadpool_t* threadpool_create(int thread_count, int queue_size);
  * @param function Funzione che eseguirà il thread.
  * @param argument Argomento passato alla funzione @function.
  * @return 0 successo, -1 altrimenti.
+ *
+ * NOTE: se la coda è piena il task viene rifiutato subito; senza
+ *       funzione di rifiuto l'errore viene segnalato su stderr.
  */
 int threadpool_add(threadpool_t* pool, void (*routine) (void*), void *arg);
 
+/**
+ * @function threadpool_try_add
+ * @brief Come threadpool_add, ma senza messaggi su stderr.
+ * @return 0 successo, -1 altrimenti, con errno a EAGAIN se la coda
+ *         è piena, ECANCELED se il threadpool è in terminazione.
+ */
+int threadpool_try_add(threadpool_t* pool, void (*routine) (void*), void *arg);
+
+/**
+ * @function threadpool_add_timed
+ * @brief Aggiunge un nuovo task, attendendo al più @timeout_ms millisecondi
+ *        che si liberi spazio nella coda (per sempre se negativo, per
+ *        niente se nullo).
+ * @return 0 successo, -1 altrimenti, con errno a ETIMEDOUT se l'attesa
+ *         è scaduta, EAGAIN o ECANCELED come per threadpool_try_add.
+ *
+ * NOTE: un task che attende spazio nel proprio threadpool può bloccarne
+ *       tutti i worker: dai worker conviene usare threadpool_try_add.
+ */
+int threadpool_add_timed(threadpool_t* pool, void (*routine) (void*), void *arg, long timeout_ms);
+
+/**
+ * @function threadpool_add_wait
+ * @brief Aggiunge un nuovo task, attendendo che si liberi spazio nella coda.
+ * @return 0 successo, -1 altrimenti (errno a ECANCELED se il threadpool
+ *         è in terminazione).
+ */
+int threadpool_add_wait(threadpool_t* pool, void (*routine) (void*), void *arg);
+
+/**
+ * @function threadpool_schedule_after
+ * @brief Sottomette il task al threadpool tra @delay_ms millisecondi.
+ *        I timer sono gestiti da una ruota gerarchica con tick di 1 ms,
+ *        fatta avanzare da un thread creato al primo timer: programmare
+ *        e cancellare un timer costa O(1), qualunque sia il numero di timer.
+ * @return L'identificatore (positivo) del timer, -1 altrimenti, con errno
+ *         a EINVAL per argomenti non validi, ECANCELED se il threadpool
+ *         è in terminazione.
+ *
+ * NOTE: allo scadere il task viene aggiunto come con threadpool_try_add:
+ *       se la coda è piena viene rifiutato (e passato alla funzione di rifiuto).
+ */
+long threadpool_schedule_after(threadpool_t* pool, long delay_ms, void (*routine) (void*), void *arg);
+
+/**
+ * @function threadpool_schedule_every
+ * @brief Sottomette il task al threadpool ogni @period_ms millisecondi,
+ *        la prima volta dopo @period_ms. Se il threadpool resta indietro
+ *        le esecuzioni perse non vengono recuperate.
+ * @return Come threadpool_schedule_after.
+ */
+long threadpool_schedule_every(threadpool_t* pool, long period_ms, void (*routine) (void*), void *arg);
+
+/**
+ * @function threadpool_cancel
+ * @brief Cancella il timer @id. Un'esecuzione già sottomessa al threadpool
+ *        viene comunque portata a termine.
+ * @return 0 successo, -1 altrimenti, con errno a ENOENT se il timer
+ *         è già scaduto o non esiste.
+ *
+ * NOTE: threadpool_destroy scarta i timer non ancora scaduti.
+ */
+int threadpool_cancel(threadpool_t* pool, long id);
+
+/**
+ * @function threadpool_stats
+ * @brief Copia in @stats le statistiche del threadpool, senza acquisirne
+ *        il lock: i valori sono letti uno alla volta e possono quindi
+ *        essere tra loro leggermente incoerenti.
+ * @return 0 successo, -1 altrimenti.
+ */
+int threadpool_stats(threadpool_t* pool, threadpool_stats_t* stats);
+
+/**
+ * @function threadpool_hist_percentile
+ * @brief Stima il quantile @q (tra 0 e 1) di un istogramma di threadpool_stats_t.
+ * @return Il limite superiore, in ns, del bucket che contiene il quantile,
+ *         0 se l'istogramma è vuoto.
+ */
+uint64_t threadpool_hist_percentile(const unsigned long* hist, double q);
+
+/**
+ * @function threadpool_cpus
+ * @brief Scrive in @cpus, al più @max, le CPU su cui il processo può girare,
+ *        nell'ordine dato dalla politica @policy (per threadpool_affinity_none
+ *        e threadpool_affinity_list in ordine di numero). Per compact e scatter
+ *        la topologia si legge da /sys: dove manca, ogni CPU è un core del nodo 0.
+ * @return Numero di CPU scritte, -1 in caso di errore.
+ */
+int threadpool_cpus(threadpool_affinity_t policy, int* cpus, int max);
+
+/**
+ * @function threadpool_bind_process
+ * @brief Restringe il thread chiamante alle @n CPU in @cpus: gli altri thread
+ *        del processo restano dove sono, mentre i figli e i thread creati da
+ *        qui in poi dal chiamante ereditano la restrizione.
+ * @return 0 successo, -1 altrimenti.
+ */
+int threadpool_bind_process(const int* cpus, int n);
+
 /**
  * @function threadpool_destroy
  * @brief Termina e distrugge il threadpool.
@@ -61,7 +289,8 @@ int threadpool_add(threadpool_t* pool, void (*routine) (void*), void *arg);
  *       enumerazione @threadpool_destroy_flags_t. In ogni caso
  *       il threadpool non accetterà nuovi task. Quando il flag vale 
  *       threadpool_graceful il threadpool processera tutti i task pendenti
- *       prima di terminare.
+ *       prima di terminare. Chi è in attesa di spazio nella coda viene
+ *       svegliato e il suo task rifiutato con ECANCELED.
  */
 int threadpool_destroy(threadpool_t* pool, int flags);
 
@@ -18,13 +18,18 @@
 #include <unistd.h>
 #include <limits.h>
 #include <string.h>
+#include <stdint.h>
 
 #define true 1
 #define false 0
 
 typedef int boolean;
 
-int __err__;
+#define NSEC_PER_SEC  1000000000ULL
+#define NSEC_PER_MSEC 1000000ULL
+
+// Appoggio per errno nella macro THREAD_ERR, definito in utils.c.
+extern int __err__;
 
 #define CALLOC(buf, nmemb, size, messg, comand)				\
 	if (((buf) = calloc((nmemb), (size))) == NULL) {		\
@@ -63,6 +68,22 @@ int __err__;
  */
 long stol(const char* str, int base);
 
+/**
+ * @function envtol
+ * @brief Legge la variabile d'ambiente @name e la converte in un intero.
+ * @return Il valore della variabile, oppure @def se non è 
+ *         definita o non è un intero valido.
+ */
+long envtol(const char* name, long def);
+
+/**
+ * @function monotonic_ns
+ * @return L'istante corrente secondo CLOCK_MONOTONIC, in nanosecondi.
+ *         A differenza di gettimeofday non risente delle correzioni
+ *         dell'orologio di sistema.
+ */
+uint64_t monotonic_ns();
+
 /**
  * @function mywrite
  */
@@ -0,0 +1,65 @@
+#define _DEFAULT_SOURCE
+
+/**
+ * @file connection.c
+ * @brief Implementazione del codec dei frame scambiati
+ *        tra client e server, dei record delle stime
+ *        inviati dal server al supervisor e di quelli
+ *        inviati dal supervisor all'aggregatore.
+ *
+ * @author Alessio Bardelli 544270
+ * 
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore
+ */
+
+#include <connection.h>
+#include <endian.h>
+#include <string.h>
+
+void frame_encode(char* buf, const Frame_t* frame) {
+
+    uint64_t id = htobe64(frame->id), send_ts = htobe64(frame->send_ts);
+    uint32_t seq = htobe32(frame->seq), flags = htobe32(frame->flags);
+
+    memcpy(buf, &id, 8); memcpy(buf + 8, &seq, 4);
+    memcpy(buf + 12, &flags, 4); memcpy(buf + 16, &send_ts, 8);
+}
+
+void frame_decode(const char* buf, Frame_t* frame) {
+
+    uint64_t id, send_ts; uint32_t seq, flags;
+
+    memcpy(&id, buf, 8); memcpy(&seq, buf + 8, 4);
+    memcpy(&flags, buf + 12, 4); memcpy(&send_ts, buf + 16, 8);
+
+    frame->id = be64toh(id); frame->seq = be32toh(seq);
+    frame->flags = be32toh(flags); frame->send_ts = be64toh(send_ts);
+}
+
+void estimate_encode(char* buf, int64_t id, int32_t stima) {
+
+    memcpy(buf, &id, 8); memcpy(buf + 8, &stima, 4);
+}
+
+void estimate_decode(const char* buf, int64_t* id, int32_t* stima) {
+
+    memcpy(id, buf, 8); memcpy(stima, buf + 8, 4);
+}
+
+void delta_encode(char* buf, int64_t id, int32_t stima, int32_t count) {
+
+    uint64_t i = htobe64((uint64_t)id);
+    uint32_t s = htobe32((uint32_t)stima), c = htobe32((uint32_t)count);
+
+    memcpy(buf, &i, 8); memcpy(buf + 8, &s, 4); memcpy(buf + 12, &c, 4);
+}
+
+void delta_decode(const char* buf, int64_t* id, int32_t* stima, int32_t* count) {
+
+    uint64_t i; uint32_t s, c;
+
+    memcpy(&i, buf, 8); memcpy(&s, buf + 8, 4); memcpy(&c, buf + 12, 4);
+
+    *id = (int64_t)be64toh(i); *stima = (int32_t)be32toh(s); *count = (int32_t)be32toh(c);
+}
@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200809L
+
 /**
  * @file dict.c
  * @brief Implementazione della struttura dati dict.
@@ -9,6 +11,144 @@
  */
 
 #include <dict.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define DICT_MIN_SLOTS DICT_GROUP // Slot iniziali dell'indice (multiplo di DICT_GROUP).
+
+/**
+ * @function hash
+ * @brief Mescola i bit della chiave (finalizzatore di splitmix64):
+ *        gli id dei client sono pid e tempi, con i bit bassi poco variabili.
+ */
+static uint64_t hash(long long int key) {
+
+	uint64_t h = (uint64_t)key;
+
+	h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27; h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+
+	return h;
+}
+
+/**
+ * @function group_match
+ * @return La maschera di bit degli slot del gruppo che inizia in @ctrl
+ *         il cui byte di controllo vale @byte.
+ */
+static unsigned int group_match(const unsigned char* ctrl, unsigned char byte) {
+
+#ifdef __SSE2__
+	__m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+	return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)byte)));
+#else
+	unsigned int mask = 0;
+
+	for (int i = 0; i < DICT_GROUP; i++)
+		if (ctrl[i] == byte)
+			mask |= 1u << i;
+
+	return mask;
+#endif
+}
+
+/**
+ * @function lookup
+ * @brief Cerca @key nell'indice, visitando i gruppi con passo crescente
+ *        (1, 2, 3, ...): con un numero di gruppi potenza di due li visita tutti.
+ * @return Lo slot della chiave se presente, altrimenti -1 e in @empty
+ *         lo slot libero in cui inserirla.
+ */
+static int lookup(Dict_t* dict, long long int key, int* empty) {
+
+	uint64_t h = hash(key); unsigned char h2 = h & 0x7f;
+	int ngroups = (dict->mask + 1) / DICT_GROUP, g = (int)(h >> 7) & (ngroups - 1);
+	unsigned int match; int s;
+
+	for (int step = 1; ; step++) {
+
+		const unsigned char* ctrl = dict->ctrl + g * DICT_GROUP;
+
+		for (match = group_match(ctrl, h2); match; match &= match - 1) {
+
+			s = g * DICT_GROUP + __builtin_ctz(match);
+
+			if (dict->entry[dict->slot[s]].key == key)
+				return s;
+		}
+
+		// Un gruppo con slot liberi chiude la ricerca: gli slot
+		// cancellati sono marcati DICT_DELETED, non liberati.
+		if ((match = group_match(ctrl, DICT_EMPTY)) != 0) {
+
+			if (empty) *empty = g * DICT_GROUP + __builtin_ctz(match);
+			return -1;
+		}
+
+		g = (g + step) & (ngroups - 1);
+	}
+}
+
+/**
+ * @function find
+ * @return La posizione in entry di @key se presente, altrimenti -1
+ *         e in @empty lo slot libero in cui inserirla.
+ */
+static int find(Dict_t* dict, long long int key, int* empty) {
+
+	int s = lookup(dict, key, empty);
+
+	return s == -1 ? -1 : dict->slot[s];
+}
+
+/**
+ * @function rehash
+ * @brief Ricostruisce l'indice con @nslots slot (potenza di due).
+ * @return 0 successo, -1 altrimenti.
+ */
+static int rehash(Dict_t* dict, int nslots) {
+
+	unsigned char* ctrl = NULL; int* slot = NULL; int s;
+
+	CALLOC(ctrl, nslots, sizeof(unsigned char), "dict: rehash: calloc", return -1)
+	CALLOC(slot, nslots, sizeof(int), "dict: rehash: calloc", free(ctrl); return -1)
+
+	memset(ctrl, DICT_EMPTY, nslots);
+
+	if (dict->ctrl) free(dict->ctrl);
+	if (dict->slot) free(dict->slot);
+
+	dict->ctrl = ctrl; dict->slot = slot; dict->mask = nslots - 1; dict->used = dict->len;
+
+	for (int i = 0; i < dict->len; i++) {
+
+		find(dict, dict->entry[i].key, &s);
+		dict->ctrl[s] = hash(dict->entry[i].key) & 0x7f; dict->slot[s] = i;
+	}
+
+	return 0;
+}
+
+/**
+ * @function slots_for
+ * @return Il numero di slot dell'indice adatto a @len chiavi:
+ *         la più piccola potenza di due piena al più per 7/16.
+ */
+static int slots_for(int len) {
+
+	int nslots = DICT_MIN_SLOTS;
+
+	while (len * 16 > nslots * 7)
+		nslots *= 2;
+
+	return nslots;
+}
 
 Dict_t* initDict() {
     
@@ -17,6 +157,15 @@ Dict_t* initDict() {
 
 	result->len = 0;
 	result->entry = NULL;
+	result->size = 0;
+	result->used = 0;
+
+	result->dirty = NULL; result->ndirty = 0; result->dirty_size = 0;
+
+	result->ctrl = NULL; result->slot = NULL;
+
+	if (rehash(result, DICT_MIN_SLOTS) == -1) {
+		free(result); return NULL; }
 
 	return result;
 }
@@ -29,36 +178,548 @@ void deleteDict(Dict_t* dict) {
 	if (dict->entry)
 		free(dict->entry);
 
+	free(dict->ctrl); free(dict->slot); free(dict->dirty);
 	free(dict);
 }
 
+/**
+ * @function mark_dirty
+ * @brief Aggiunge l'entry @i alla lista di quelle modificate, se non c'è già.
+ */
+static void mark_dirty(Dict_t* dict, int i) {
+
+	if (dict->entry[i].dirty)
+		return;
+
+	if (dict->ndirty == dict->dirty_size) {
+
+		int newsize = dict->dirty_size ? 2 * dict->dirty_size : DICT_MIN_SLOTS;
+		int* dirty = realloc(dict->dirty, newsize * sizeof(int));
+
+		// Senza memoria l'entry non comparirà in foreach_dirty, ma il dizionario resta valido.
+		if (!dirty) {
+			perror("dict: mark_dirty: realloc"); return; }
+
+		dict->dirty = dirty; dict->dirty_size = newsize;
+	}
+
+	dict->dirty[dict->ndirty++] = i;
+	dict->entry[i].dirty = dict->ndirty;
+}
+
+void clean(Dict_t* dict) {
+
+	for (int i = 0; i < dict->ndirty; i++)
+		dict->entry[dict->dirty[i]].dirty = 0;
+
+	dict->ndirty = 0;
+}
+
 void add(Dict_t* dict, long long int key, struct value_t value) {
 	
-	int i;
+	int i, s;
 
-	for (i = 0; i < dict->len; i++)
-		if (dict->entry[i].key == key)
-			break;
-	
-	if (i == dict->len)	{
+	if ((i = find(dict, key, &s)) == -1) {
+
+		// L'indice viene tenuto pieno al più per 7/8, contando gli slot cancellati,
+		// che la ricostruzione elimina.
+		if ((dict->used + 1) * 8 > (dict->mask + 1) * 7) {
+
+			if (rehash(dict, slots_for(dict->len + 1)) == -1) return;
+			find(dict, key, &s);
+		}
+
+		if (dict->len == dict->size) {
+
+			int newsize = dict->size ? 2 * dict->size : DICT_MIN_SLOTS;
+			REALLOC(dict->entry, newsize * sizeof(Entry_t), "addDict: realloc", return)
 
-		int newsize = (dict->len+1) * sizeof(Entry_t);
-		REALLOC(dict->entry, newsize, "addDict: realloc", return)
+			dict->size = newsize;
+		}
 
-		dict->entry[i].key = key;
-		dict->len += 1;
+		i = dict->len;
+
+		dict->entry[i].key = key; dict->entry[i].dirty = 0;
+		dict->len += 1; dict->used += 1;
+
+		dict->ctrl[s] = hash(key) & 0x7f; dict->slot[s] = i;
 	}
 
 	dict->entry[i].value = value;
+	dict->entry[i].last = monotonic_ns() / NSEC_PER_MSEC;
+
+	mark_dirty(dict, i);
+}
+
+struct value_t merge(Dict_t* dict, long long int key, int stima, int count) {
+
+	struct value_t value = {stima, count};
+	int i = find(dict, key, NULL);
+
+	if (i != -1) {
+
+		if (dict->entry[i].value.miglior_stima < stima) value.miglior_stima = dict->entry[i].value.miglior_stima;
+		value.count_server += dict->entry[i].value.count_server;
+	}
+
+	add(dict, key, value);
+	return value;
 }
 
 struct value_t get_value(Dict_t* dict, long long int key) {
 
 	struct value_t result = {INT_MAX, 0};
+	int i = find(dict, key, NULL);
+
+	if (i != -1)
+		return (dict->entry[i].value);
+
+	return result;
+}
+
+/**
+ * @function remove_at
+ * @brief Rimuove l'entry in posizione @i, spostando al suo posto l'ultima.
+ */
+static void remove_at(Dict_t* dict, int i) {
+
+	int s = lookup(dict, dict->entry[i].key, NULL), last = dict->len - 1, d;
+
+	dict->ctrl[s] = DICT_DELETED;
+
+	// L'entry esce dalla lista delle modificate, al suo posto va l'ultima della lista.
+	if ((d = dict->entry[i].dirty) != 0) {
+
+		dict->dirty[d - 1] = dict->dirty[--dict->ndirty];
+		dict->entry[dict->dirty[d - 1]].dirty = d;
+	}
+
+	if (i != last) {
+
+		dict->entry[i] = dict->entry[last];
+		dict->slot[lookup(dict, dict->entry[i].key, NULL)] = i;
+
+		if (dict->entry[i].dirty)
+			dict->dirty[dict->entry[i].dirty - 1] = i;
+	}
+
+	dict->len -= 1;
+}
+
+/**
+ * @function cmp_last
+ * @brief Confronto tra istanti di aggiornamento, per qsort.
+ */
+static int cmp_last(const void* a, const void* b) {
+
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * @function evict_oldest
+ * @brief Rimuove le @n entry meno recenti: quelle aggiornate prima
+ *        dell'n-esimo istante e, a parità di istante, quante ne mancano.
+ * @return Numero di entry rimosse.
+ */
+static int evict_oldest(Dict_t* dict, int n, dict_archive_t archive, void* arg) {
+
+	uint64_t* lasts = NULL, threshold; int evicted = 0, ties = n;
+
+	CALLOC(lasts, dict->len, sizeof(uint64_t), "evict: calloc", return 0)
+
+	for (int i = 0; i < dict->len; i++)
+		lasts[i] = dict->entry[i].last;
+
+	qsort(lasts, dict->len, sizeof(uint64_t), cmp_last);
+	threshold = lasts[n - 1];
+
+	for (int i = 0; i < n && lasts[i] < threshold; i++)
+		ties--;
+
+	free(lasts);
+
+	for (int i = dict->len - 1; i >= 0; i--)
+		if (dict->entry[i].last < threshold || (dict->entry[i].last == threshold && ties-- > 0)) {
+
+			if (archive) archive(&dict->entry[i], arg);
+			remove_at(dict, i); evicted++;
+		}
+
+	return evicted;
+}
+
+/**
+ * @function shrink
+ * @brief Dopo una rimozione massiccia restituisce la memoria in eccesso.
+ */
+static void shrink(Dict_t* dict) {
+
+	if (slots_for(dict->len) * 4 <= dict->mask + 1)
+		rehash(dict, slots_for(dict->len));
+
+	if (dict->size > DICT_MIN_SLOTS && dict->len * 4 <= dict->size) {
+
+		Entry_t* entry = realloc(dict->entry, (dict->size / 2) * sizeof(Entry_t));
+		if (entry) { dict->entry = entry; dict->size /= 2; }
+	}
+}
+
+int evict(Dict_t* dict, long ttl_ms, int cap, dict_archive_t archive, void* arg) {
+
+	uint64_t now = monotonic_ns() / NSEC_PER_MSEC; int evicted = 0;
+
+	// Scorrendo all'indietro, l'entry spostata al posto di una rimossa è già stata esaminata.
+	if (ttl_ms > 0)
+		for (int i = dict->len - 1; i >= 0; i--)
+			if (now - dict->entry[i].last > (uint64_t)ttl_ms) {
+
+				if (archive) archive(&dict->entry[i], arg);
+				remove_at(dict, i); evicted++;
+			}
+
+	// Oltre il limite si scende a 7/8 di @cap, per non ripetere la selezione ad ogni nuova chiave.
+	if (cap > 0 && dict->len > cap)
+		evicted += evict_oldest(dict, dict->len - (cap >= 8 ? cap - cap / 8 : cap), archive, arg);
+
+	if (evicted > 0)
+		shrink(dict);
+
+	return evicted;
+}
 
-    for (int i = 0; i < dict->len; i++)
-		if (dict->entry[i].key == key)
-			return (dict->entry[i].value);
+/**
+ * @function checksum
+ * @brief FNV-1a a 64 bit sulle parole di 8 byte delle entry
+ *        (sizeof(Entry_t) è multiplo di 8) e sul loro numero.
+ */
+static uint64_t checksum(const Entry_t* entry, uint64_t len) {
+
+	const uint64_t* word = (const uint64_t*)entry; uint64_t h = 0xcbf29ce484222325ULL;
+	size_t nwords = len * sizeof(Entry_t) / sizeof(uint64_t);
+
+	for (size_t i = 0; i < nwords; i++) {
+		h ^= word[i]; h *= 0x100000001b3ULL; }
+
+	h ^= len; h *= 0x100000001b3ULL;
+
+	return h;
+}
+
+/**
+ * @function write_all
+ * @brief Scrive @len byte di @buf su @fd, anche con più write.
+ * @return 0 successo, -1 altrimenti.
+ */
+static int write_all(int fd, const void* buf, size_t len) {
+
+	const char* p = buf; ssize_t n;
+
+	while (len > 0) {
+
+		if ((n = write(fd, p, len)) == -1) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+
+		p += n; len -= n;
+	}
+
+	return 0;
+}
+
+/**
+ * @function save_entries
+ * @brief Scrive in @path lo snapshot delle @len entry di @entry.
+ * @return 0 successo, -1 altrimenti.
+ */
+static int save_entries(const Entry_t* entry, int len, const char* path) {
+
+	DictSnapshot_t header; char tmp[PATH_MAX]; int fd;
+
+	if (snprintf(tmp, PATH_MAX, "%s.tmp", path) >= PATH_MAX) {
+		errno = ENAMETOOLONG; return -1; }
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, DICT_SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = DICT_SNAPSHOT_VERSION; header.entry_size = sizeof(Entry_t);
+	header.len = len; header.checksum = checksum(entry, len);
+
+	MENO1(fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644), "saveDict: open", return -1)
+
+	if (write_all(fd, &header, sizeof(header)) == -1 || write_all(fd, entry, len * sizeof(Entry_t)) == -1 || fsync(fd) == -1) {
+		perror("saveDict: write"); close(fd); unlink(tmp); return -1; }
+
+	close(fd);
+
+	MENO1(rename(tmp, path), "saveDict: rename", unlink(tmp); return -1)
+
+	return 0;
+}
+
+int saveDict(Dict_t* dict, const char* path) {
+
+	return save_entries(dict->entry, dict->len, path);
+}
+
+Dict_t* loadDict(const char* path) {
+
+	const DictSnapshot_t* header; const Entry_t* entry; Dict_t* result = NULL;
+	struct stat st; void* map = MAP_FAILED; uint64_t now; int fd;
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return NULL;
+
+	if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(DictSnapshot_t))
+		goto invalid;
+
+	if ((map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+		goto invalid;
+
+	header = (const DictSnapshot_t*)map; entry = (const Entry_t*)(header + 1);
+
+	if (memcmp(header->magic, DICT_SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 || header->version != DICT_SNAPSHOT_VERSION ||
+			header->entry_size != sizeof(Entry_t) || header->len > INT_MAX / 2 ||
+			(uint64_t)st.st_size != sizeof(DictSnapshot_t) + header->len * sizeof(Entry_t) ||
+			checksum(entry, header->len) != header->checksum)
+		goto invalid;
+
+	if ((result = initDict()) == NULL)
+		goto invalid;
+
+	// Le entry si copiano in blocco, poi si ricostruisce l'indice.
+	if (header->len > 0) {
+
+		result->size = slots_for((int)header->len);
+		CALLOC(result->entry, result->size, sizeof(Entry_t), "loadDict: calloc", deleteDict(result); result = NULL; goto invalid)
+
+		memcpy(result->entry, entry, header->len * sizeof(Entry_t));
+		result->len = (int)header->len;
+
+		if (rehash(result, slots_for(result->len)) == -1) {
+			deleteDict(result); result = NULL; goto invalid; }
+	}
+
+	// Gli istanti di CLOCK_MONOTONIC non sopravvivono ad un riavvio.
+	now = monotonic_ns() / NSEC_PER_MSEC;
+
+	for (int i = 0; i < result->len; i++) {
+		result->entry[i].last = now; result->entry[i].dirty = 0; }
+
+	munmap(map, st.st_size); close(fd);
+	return result;
+
+invalid:
+	if (map != MAP_FAILED) munmap(map, st.st_size);
+	close(fd); errno = EINVAL;
+	return NULL;
+}
+
+/**
+ * @function shard_of
+ * @brief Sceglie lo shard dai bit alti dell'hash: quelli bassi
+ *        servono all'indice del Dict_t dello shard.
+ */
+static struct cdict_shard_t* shard_of(CDict_t* cdict, long long int key) {
+
+	return &cdict->shard[(hash(key) >> 40) & (cdict->nshards - 1)];
+}
+
+CDict_t* initCDict(int nshards) {
+
+	CDict_t* result = NULL; int n = 1;
+
+	if (nshards <= 0 && (nshards = (int)sysconf(_SC_NPROCESSORS_ONLN)) <= 0)
+		nshards = 1;
+
+	while (n < nshards) n *= 2;
+
+	CALLOC(result, 1, sizeof(CDict_t), "initCDict: calloc", return NULL)
+	CALLOC(result->shard, n, sizeof(struct cdict_shard_t), "initCDict: calloc", free(result); return NULL)
+
+	for (result->nshards = 0; result->nshards < n; result->nshards++) {
+
+		struct cdict_shard_t* shard = &result->shard[result->nshards];
+
+		if ((shard->dict = initDict()) == NULL) {
+			deleteCDict(result); return NULL; }
+
+		THREAD_ERR(pthread_rwlock_init(&shard->lock, NULL), "initCDict: pthread_rwlock_init", deleteDict(shard->dict); deleteCDict(result); return NULL)
+	}
+
+	return result;
+}
+
+void deleteCDict(CDict_t* cdict) {
+
+	if (!cdict)
+		return;
+
+	for (int s = 0; s < cdict->nshards; s++) {
+		pthread_rwlock_destroy(&cdict->shard[s].lock); deleteDict(cdict->shard[s].dict); }
+
+	free(cdict->shard);
+	free(cdict);
+}
+
+void cdict_add(CDict_t* cdict, long long int key, struct value_t value) {
+
+	struct cdict_shard_t* shard = shard_of(cdict, key);
+
+	pthread_rwlock_wrlock(&shard->lock);
+	add(shard->dict, key, value);
+	pthread_rwlock_unlock(&shard->lock);
+}
+
+struct value_t cdict_get_value(CDict_t* cdict, long long int key) {
+
+	struct cdict_shard_t* shard = shard_of(cdict, key);
+	struct value_t result = {INT_MAX, 0}; int i;
+
+	pthread_rwlock_rdlock(&shard->lock);
+
+	if ((i = find(shard->dict, key, NULL)) != -1)
+		__atomic_load(&shard->dict->entry[i].value, &result, __ATOMIC_RELAXED);
+
+	pthread_rwlock_unlock(&shard->lock);
 
 	return result;
 }
+
+struct value_t cdict_update(CDict_t* cdict, long long int key, int stima) {
+
+	return cdict_merge(cdict, key, stima, 1);
+}
+
+struct value_t cdict_merge(CDict_t* cdict, long long int key, int stima, int count) {
+
+	struct cdict_shard_t* shard = shard_of(cdict, key);
+	struct value_t old, new; int i;
+
+	pthread_rwlock_rdlock(&shard->lock);
+
+	// Chiave presente e già modificata: il lock in lettura impedisce solo che entry
+	// venga riallocato, il valore (8 byte) si aggiorna con una compare-and-swap.
+	if ((i = find(shard->dict, key, NULL)) != -1 && __atomic_load_n(&shard->dict->entry[i].dirty, __ATOMIC_RELAXED)) {
+
+		struct value_t* value = &shard->dict->entry[i].value;
+
+		__atomic_load(value, &old, __ATOMIC_RELAXED);
+
+		do {
+			new.miglior_stima = old.miglior_stima < stima ? old.miglior_stima : stima;
+			new.count_server = old.count_server + count;
+		} while (!__atomic_compare_exchange(value, &old, &new, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+		__atomic_store_n(&shard->dict->entry[i].last, monotonic_ns() / NSEC_PER_MSEC, __ATOMIC_RELAXED);
+
+		pthread_rwlock_unlock(&shard->lock);
+		return new;
+	}
+
+	pthread_rwlock_unlock(&shard->lock);
+
+	// Chiave assente, o prima modifica dopo un clean: serve il lock
+	// in scrittura, nel frattempo un altro thread può averla già aggiunta.
+	pthread_rwlock_wrlock(&shard->lock);
+	new = merge(shard->dict, key, stima, count);
+	pthread_rwlock_unlock(&shard->lock);
+
+	return new;
+}
+
+int cdict_drain(CDict_t* cdict, dict_archive_t fn, void* arg) {
+
+	int drained = 0;
+
+	for (int s = 0; s < cdict->nshards; s++) {
+
+		Dict_t *empty, *full;
+
+		NULL_ERR(empty = initDict(), "cdict_drain: initDict", return -1)
+
+		pthread_rwlock_wrlock(&cdict->shard[s].lock);
+		full = cdict->shard[s].dict; cdict->shard[s].dict = empty;
+		pthread_rwlock_unlock(&cdict->shard[s].lock);
+
+		for (int i = 0; i < full->len; i++)
+			fn(&full->entry[i], arg);
+
+		drained += full->len;
+		deleteDict(full);
+	}
+
+	return drained;
+}
+
+int cdict_evict(CDict_t* cdict, long ttl_ms, int cap, dict_archive_t archive, void* arg) {
+
+	int evicted = 0, shard_cap = cap > 0 ? (cap + cdict->nshards - 1) / cdict->nshards : 0;
+
+	for (int s = 0; s < cdict->nshards; s++) {
+
+		pthread_rwlock_wrlock(&cdict->shard[s].lock);
+		evicted += evict(cdict->shard[s].dict, ttl_ms, shard_cap, archive, arg);
+		pthread_rwlock_unlock(&cdict->shard[s].lock);
+	}
+
+	return evicted;
+}
+
+int saveCDict(CDict_t* cdict, const char* path) {
+
+	Entry_t* entry = NULL; int len = 0, size = 0, res;
+
+	// Copio le entry di uno shard alla volta, con il solo lock in lettura:
+	// la scrittura su file avviene senza alcun lock acquisito.
+	for (int s = 0; s < cdict->nshards; s++) {
+
+		struct cdict_shard_t* shard = &cdict->shard[s];
+
+		pthread_rwlock_rdlock(&shard->lock);
+
+		if (len + shard->dict->len > size) {
+
+			Entry_t* tmp = realloc(entry, (size = 2 * (len + shard->dict->len)) * sizeof(Entry_t));
+
+			if (!tmp) {
+				pthread_rwlock_unlock(&shard->lock); perror("saveCDict: realloc"); free(entry); return -1; }
+
+			entry = tmp;
+		}
+
+		// Il valore può essere aggiornato in parallelo da cdict_update.
+		for (int i = 0; i < shard->dict->len; i++, len++) {
+
+			memset(&entry[len], 0, sizeof(Entry_t)); entry[len].key = shard->dict->entry[i].key;
+			entry[len].last = __atomic_load_n(&shard->dict->entry[i].last, __ATOMIC_RELAXED);
+			__atomic_load(&shard->dict->entry[i].value, &entry[len].value, __ATOMIC_RELAXED);
+		}
+
+		pthread_rwlock_unlock(&shard->lock);
+	}
+
+	res = save_entries(entry, len, path);
+
+	free(entry); return res;
+}
+
+CDict_t* loadCDict(const char* path, int nshards) {
+
+	Dict_t* dict; CDict_t* result;
+
+	if ((dict = loadDict(path)) == NULL)
+		return NULL;
+
+	if ((result = initCDict(nshards)) != NULL) {
+
+		for (int i = 0; i < dict->len; i++)
+			cdict_add(result, dict->entry[i].key, dict->entry[i].value);
+
+		for (int s = 0; s < result->nshards; s++)
+			clean(result->shard[s].dict);
+	}
+
+	deleteDict(dict); return result;
+}
@@ -0,0 +1,193 @@
+#define _GNU_SOURCE
+
+/**
+ * @file iouring.c
+ * @brief Implementazione dell'interfaccia minimale verso io_uring,
+ *        basata direttamente sulle system call (senza liburing).
+ *
+ * @author Alessio Bardelli 544270
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore
+ */
+
+#include <iouring.h>
+
+#ifdef HAVE_IO_URING
+
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define load_acquire(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+int uring_init(Uring_t* ring, unsigned entries) {
+
+    struct io_uring_params p; char* sq;
+
+    memset(ring, 0, sizeof(*ring)); memset(&p, 0, sizeof(p));
+
+    // Le richieste multishot producono molti completamenti per
+    // ogni sqe: la completion queue è quindi più grande del solito.
+    p.flags = IORING_SETUP_CQSIZE; p.cq_entries = entries * 8;
+
+    MENO1(ring->fd = syscall(__NR_io_uring_setup, entries, &p), "uring_init: io_uring_setup", return -1)
+
+    ring->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        ring->sq_sz = ring->cq_sz = (ring->sq_sz > ring->cq_sz) ? ring->sq_sz : ring->cq_sz;
+
+    ring->sq_ptr = mmap(NULL, ring->sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) { perror("uring_init: mmap sq"); goto err; }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        ring->cq_ptr = ring->sq_ptr;
+
+    else {
+
+        ring->cq_ptr = mmap(NULL, ring->cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) { perror("uring_init: mmap cq"); ring->cq_ptr = NULL; goto err; }
+    }
+
+    ring->sqes = mmap(NULL, ring->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) { perror("uring_init: mmap sqes"); ring->sqes = NULL; goto err; }
+
+    sq = ring->sq_ptr;
+    ring->sq_head = (unsigned*)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    ring->sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    ring->sq_entries = p.sq_entries;
+    ring->sq_array = (unsigned*)(sq + p.sq_off.array);
+    ring->sq_local = *ring->sq_tail;
+
+    ring->cq_head = (unsigned*)((char*)ring->cq_ptr + p.cq_off.head);
+    ring->cq_tail = (unsigned*)((char*)ring->cq_ptr + p.cq_off.tail);
+    ring->cq_mask = *(unsigned*)((char*)ring->cq_ptr + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)((char*)ring->cq_ptr + p.cq_off.cqes);
+
+    return 0;
+
+    err: {
+
+        if (ring->sq_ptr == MAP_FAILED) ring->sq_ptr = NULL;
+        uring_exit(ring); return -1;
+    }
+}
+
+void uring_exit(Uring_t* ring) {
+
+    if (ring->sqes) munmap(ring->sqes, ring->sqes_sz);
+    if (ring->cq_ptr && ring->cq_ptr != ring->sq_ptr) munmap(ring->cq_ptr, ring->cq_sz);
+    if (ring->sq_ptr) munmap(ring->sq_ptr, ring->sq_sz);
+
+    close(ring->fd); memset(ring, 0, sizeof(*ring)); ring->fd = -1;
+}
+
+struct io_uring_sqe* uring_get_sqe(Uring_t* ring) {
+
+    struct io_uring_sqe* sqe; unsigned idx;
+
+    if (ring->sq_local - load_acquire(ring->sq_head) >= ring->sq_entries)
+        return NULL;
+
+    idx = ring->sq_local & ring->sq_mask;
+    sqe = &ring->sqes[idx]; memset(sqe, 0, sizeof(*sqe));
+
+    ring->sq_array[idx] = idx; ring->sq_local++;
+
+    return sqe;
+}
+
+int uring_submit_and_wait(Uring_t* ring, unsigned wait_nr, int timeout_ms) {
+
+    struct __kernel_timespec ts; struct io_uring_getevents_arg arg; unsigned to_submit; int res;
+
+    to_submit = ring->sq_local - *ring->sq_tail;
+    store_release(ring->sq_tail, ring->sq_local);
+
+    memset(&arg, 0, sizeof(arg));
+    ts.tv_sec = timeout_ms / 1000; ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    arg.ts = (unsigned long long)(uintptr_t)&ts;
+
+    res = syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_nr,
+                  IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+
+    if (res == -1 && (errno == ETIME || errno == EINTR))
+        return 0;
+
+    return res;
+}
+
+struct io_uring_cqe* uring_peek_cqe(Uring_t* ring) {
+
+    unsigned head = *ring->cq_head;
+
+    if (head == load_acquire(ring->cq_tail))
+        return NULL;
+
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(Uring_t* ring) { store_release(ring->cq_head, *ring->cq_head + 1); }
+
+int uring_bufs_init(Uring_t* ring, UringBufs_t* bufs, unsigned short bgid, unsigned entries, unsigned bufsize) {
+
+    struct io_uring_buf_reg reg; size_t ring_sz = entries * sizeof(struct io_uring_buf);
+
+    memset(bufs, 0, sizeof(*bufs));
+    bufs->entries = entries; bufs->bufsize = bufsize; bufs->bgid = bgid;
+
+    // L'anello deve essere allineato alla pagina.
+    bufs->br = mmap(NULL, ring_sz, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (bufs->br == MAP_FAILED) { perror("uring_bufs_init: mmap"); bufs->br = NULL; return -1; }
+
+    CALLOC(bufs->bufs, entries, bufsize, "uring_bufs_init: calloc", munmap(bufs->br, ring_sz); return -1)
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long long)(uintptr_t)bufs->br;
+    reg.ring_entries = entries; reg.bgid = bgid;
+
+    MENO1 (
+        syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1),
+        "uring_bufs_init: io_uring_register",
+        free(bufs->bufs); munmap(bufs->br, ring_sz); return -1
+    )
+
+    bufs->br->tail = 0;
+
+    for (unsigned i = 0; i < entries; i++)
+        uring_bufs_recycle(bufs, i);
+
+    return 0;
+}
+
+void uring_bufs_recycle(UringBufs_t* bufs, unsigned short bid) {
+
+    unsigned short tail = bufs->br->tail;
+    struct io_uring_buf* buf = &bufs->br->bufs[tail & (bufs->entries - 1)];
+
+    buf->addr = (unsigned long long)(uintptr_t)uring_bufs_get(bufs, bid);
+    buf->len = bufs->bufsize; buf->bid = bid;
+
+    store_release(&bufs->br->tail, (unsigned short)(tail + 1));
+}
+
+void uring_bufs_exit(Uring_t* ring, UringBufs_t* bufs) {
+
+    struct io_uring_buf_reg reg;
+
+    if (!bufs->br)
+        return;
+
+    memset(&reg, 0, sizeof(reg)); reg.bgid = bufs->bgid;
+    syscall(__NR_io_uring_register, ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+
+    munmap(bufs->br, bufs->entries * sizeof(struct io_uring_buf));
+    free(bufs->bufs); memset(bufs, 0, sizeof(*bufs));
+}
+
+#endif // HAVE_IO_URING
@@ -0,0 +1,439 @@
+#define _POSIX_C_SOURCE 200809L
+
+/**
+ * @file logger.c
+ * @brief Implementazione del logger asincrono.
+ *
+ * @author Alessio Bardelli 544270
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore
+ */
+
+#include <logger.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+
+#define IDLE_MIN_NS 200000 // Prima attesa del logger senza record da scrivere, poi raddoppiata...
+#define IDLE_MAX_NS 10000000 // ...fino a questo valore.
+
+#define load_acquire(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/**
+ * @struct Record_t
+ * @brief Record binario: viene formattato solo dal thread del logger.
+ */
+typedef struct {
+
+    int flags;
+    const char* fmt;
+    long args[4];
+
+} Record_t;
+
+/**
+ * @struct Ring_t
+ * @brief Buffer circolare privato di un thread: il thread è l'unico
+ *        produttore (tail), il thread del logger l'unico consumatore (head).
+ */
+typedef struct Ring_t {
+
+    Record_t rec[LOG_RING_SIZE];
+
+    unsigned long tail;             /**< Prossimo record da scrivere (produttore). */
+    unsigned long sampled;          /**< Record LOG_SHEDDABLE visti, per il campionamento. */
+    int busy;                       /**< Il produttore sta scrivendo un record. */
+    char pad[64];                   /**< Separa i due indici su linee di cache diverse. */
+    unsigned long head;             /**< Prossimo record da leggere (consumatore). */
+    int orphaned;                   /**< Il thread è terminato: svuotato, il buffer si libera. */
+
+    struct Ring_t* next;            /**< Lista dei buffer registrati. */
+
+} Ring_t;
+
+/**
+ * @struct Batch_t
+ * @brief Buffer in cui il thread del logger formatta i record
+ *        destinati ad uno stesso file descriptor.
+ */
+typedef struct {
+
+    int fd;
+    int len;
+    char buf[LOG_BATCH_SIZE];
+
+} Batch_t;
+
+static __thread Ring_t* ring = NULL; // Buffer del thread corrente...
+static __thread unsigned long ring_gen = 0; // ...valido solo se registrato in questa generazione.
+
+// Lista di tutti i buffer: inserimenti e rimozioni sono serializzati da lock,
+// il thread del logger (l'unico che rimuove) la scorre senza lock.
+static Ring_t* rings = NULL;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Alla terminazione di un thread il suo buffer viene segnato come orfano.
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+// Incrementata da logger_exit, con lock: i buffer delle generazioni precedenti
+// sono stati liberati o, se il thread è ancora vivo, staccati dalla lista.
+static unsigned long generation = 1;
+
+static pthread_t tid;
+static int running = false, stopping = false;
+static int sample = 1, drop = false;
+static unsigned long dropped = 0;
+
+static Batch_t batch[2] = { {STDOUT_FILENO, 0}, {STDERR_FILENO, 0} };
+
+/**
+ * @function pause_short
+ * @brief Attesa di @ns nanosecondi (meno di un secondo), usata quando non c'è nulla da fare.
+ */
+static void pause_short(long ns) {
+
+    struct timespec ts = {0, ns};
+    nanosleep(&ts, NULL);
+}
+
+/**
+ * @function batch_write
+ * @brief Scrive su file il contenuto del batch.
+ */
+static void batch_write(Batch_t* b) {
+
+    int off = 0, n;
+
+    while (off < b->len) {
+
+        if ((n = write(b->fd, b->buf + off, b->len - off)) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        off += n;
+    }
+
+    b->len = 0;
+}
+
+/**
+ * @function batch_append
+ * @brief Formatta il record in coda al batch del suo file descriptor,
+ *        svuotando prima il batch se non c'è abbastanza spazio.
+ */
+static void batch_append(Record_t* r) {
+
+    Batch_t* b = &batch[r->flags & LOG_STDERR]; int n;
+
+    for (int retry = 0; retry < 2; retry++) {
+
+        n = snprintf(b->buf + b->len, LOG_BATCH_SIZE - b->len, r->fmt, r->args[0], r->args[1], r->args[2], r->args[3]);
+
+        if (n < LOG_BATCH_SIZE - b->len) {
+            b->len += n; return; }
+
+        batch_write(b);
+    }
+
+    // Record più lungo dell'intero batch: viene troncato.
+    b->len = LOG_BATCH_SIZE - 1; batch_write(b);
+}
+
+/**
+ * @function reclaim
+ * @brief Toglie dalla lista e libera il buffer orfano @r, già svuotato.
+ *        Se il lock è occupato (ad esempio da logger_flush) ci si riprova
+ *        al giro successivo.
+ * @return true se il buffer è stato liberato.
+ */
+static int reclaim(Ring_t* r) {
+
+    Ring_t** p;
+
+    if (pthread_mutex_trylock(&lock) != 0)
+        return false;
+
+    for (p = &rings; *p != NULL && *p != r; p = &(*p)->next);
+    if (*p) *p = r->next;
+
+    pthread_mutex_unlock(&lock);
+
+    free(r); return true;
+}
+
+/**
+ * @function drain
+ * @brief Formatta e scrive tutti i record presenti nei buffer.
+ *        Lo spazio di un buffer viene restituito al produttore solo
+ *        dopo la write, così logger_flush sa quando i record sono su file.
+ *        I buffer dei thread terminati, una volta vuoti, vengono liberati.
+ * @return Numero di record scritti.
+ */
+static unsigned long drain() {
+
+    unsigned long head, tail, count = 0; Ring_t *r, *next;
+
+    for (r = load_acquire(&rings); r != NULL; r = next) {
+
+        // Il thread segna il buffer come orfano dopo il suo ultimo record:
+        // letto orphaned, tail non cambia più.
+        int orphaned = load_acquire(&r->orphaned);
+
+        next = r->next; head = r->head; tail = load_acquire(&r->tail);
+
+        if (head != tail) {
+
+            for (; head != tail; head++)
+                batch_append(&r->rec[head & (LOG_RING_SIZE - 1)]);
+
+            batch_write(&batch[0]); batch_write(&batch[1]);
+
+            count += tail - r->head;
+            store_release(&r->head, head);
+        }
+
+        if (orphaned)
+            reclaim(r);
+    }
+
+    return count;
+}
+
+/**
+ * @function ring_orphan
+ * @brief Distruttore di ring_key, alla terminazione di un thread: il buffer
+ *        verrà liberato dal thread del logger dopo averlo svuotato, oppure
+ *        subito se logger_exit lo ha già staccato dalla lista.
+ */
+static void ring_orphan(void* arg) {
+
+    pthread_mutex_lock(&lock);
+
+    if (arg == ring && ring_gen == generation)
+        store_release(&ring->orphaned, true);
+
+    else if (arg == ring)
+        free(ring);
+
+    pthread_mutex_unlock(&lock);
+
+    ring = NULL;
+}
+
+/**
+ * @function ring_key_create
+ * @brief Crea, una sola volta, la chiave che associa ad ogni thread il suo buffer.
+ */
+static void ring_key_create() {
+
+    THREAD_ERR(pthread_key_create(&ring_key, ring_orphan), "logger: ring_key_create: pthread_key_create", )
+}
+
+/**
+ * @function logger_thread
+ * @brief Thread del logger: svuota periodicamente i buffer.
+ */
+static void* logger_thread(void* arg) {
+
+    long idle = IDLE_MIN_NS;
+
+    // Senza record l'attesa si allunga: centinaia di processi con il
+    // logger inattivo non devono tenere occupate le CPU.
+    while (true) {
+
+        if (drain() > 0) {
+            idle = IDLE_MIN_NS; continue; }
+
+        if (load_acquire(&stopping))
+            break;
+
+        pause_short(idle);
+        if ((idle *= 2) > IDLE_MAX_NS) idle = IDLE_MAX_NS;
+    }
+
+    return NULL;
+}
+
+/**
+ * @function ring_get
+ * @brief Restituisce il buffer del thread corrente, registrandolo
+ *        al primo utilizzo.
+ */
+static Ring_t* ring_get() {
+
+    if (ring && ring_gen == load_acquire(&generation))
+        return ring;
+
+    // Un buffer di una generazione precedente è stato staccato da logger_exit:
+    // ormai lo usa soltanto questo thread.
+    free(ring);
+
+    CALLOC(ring, 1, sizeof(Ring_t), "logger: ring_get: calloc", return NULL)
+
+    pthread_mutex_lock(&lock);
+
+    // logger_exit azzera running prima di scorrere la lista: dopo non si registra nulla.
+    if (!load_acquire(&running)) {
+        pthread_mutex_unlock(&lock); free(ring); ring = NULL; return NULL; }
+
+    ring_gen = generation;
+    ring->next = rings; store_release(&rings, ring);
+
+    pthread_mutex_unlock(&lock);
+
+    pthread_setspecific(ring_key, ring);
+
+    return ring;
+}
+
+int logger_init() {
+
+    sigset_t all, old;
+
+    if (running)
+        return 0;
+
+    pthread_once(&ring_key_once, ring_key_create);
+
+    sample = (int)envtol("OOB_LOG_SAMPLE", 1);
+    if (sample < 1) sample = 1;
+
+    drop = envtol("OOB_LOG_DROP", 0) != 0;
+
+    // Ciò che è stato scritto in modo sincrono deve precedere i record.
+    fflush(stdout); fflush(stderr);
+
+    // Il thread del logger non deve ricevere i segnali destinati al processo.
+    sigfillset(&all); pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    stopping = false;
+    THREAD_ERR (
+        pthread_create(&tid, NULL, logger_thread, NULL),
+        "logger_init: pthread_create",
+        pthread_sigmask(SIG_SETMASK, &old, NULL); return -1
+    )
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    store_release(&running, true); return 0;
+}
+
+/**
+ * @function write_sync
+ * @brief Scrittura sincrona di un record, senza il thread del logger.
+ */
+static void write_sync(int flags, const char* fmt, long a, long b, long c, long d) {
+
+    FILE* file = (flags & LOG_STDERR) ? stderr : stdout;
+
+    fprintf(file, fmt, a, b, c, d); fflush(file);
+}
+
+void logger_write(int flags, const char* fmt, long a, long b, long c, long d) {
+
+    Ring_t* r; Record_t* rec; unsigned long tail;
+
+    // Logger non avviato (o non più attivo): scrittura sincrona.
+    if (!load_acquire(&running) || (r = ring_get()) == NULL) {
+        write_sync(flags, fmt, a, b, c, d); return; }
+
+    // Mi dichiaro occupato sul mio buffer prima di ricontrollare running:
+    // logger_exit, azzerato running, attende che nessun buffer sia occupato.
+    // Il flag sta sulla linea di cache del produttore, come tail.
+    __atomic_store_n(&r->busy, true, __ATOMIC_SEQ_CST);
+
+    if (!__atomic_load_n(&running, __ATOMIC_SEQ_CST)) {
+        store_release(&r->busy, false); write_sync(flags, fmt, a, b, c, d); return; }
+
+    if ((flags & LOG_SHEDDABLE) && sample > 1 && (r->sampled++ % sample) != 0) {
+        store_release(&r->busy, false); return; }
+
+    tail = r->tail;
+
+    // Buffer pieno: i record scartabili possono essere persi,
+    // per gli altri si attende che il logger liberi spazio.
+    while (tail - load_acquire(&r->head) >= LOG_RING_SIZE) {
+
+        if ((flags & LOG_SHEDDABLE) && drop) {
+            __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED); store_release(&r->busy, false); return; }
+
+        sched_yield();
+    }
+
+    rec = &r->rec[tail & (LOG_RING_SIZE - 1)];
+    rec->flags = flags; rec->fmt = fmt;
+    rec->args[0] = a; rec->args[1] = b; rec->args[2] = c; rec->args[3] = d;
+
+    store_release(&r->tail, tail + 1);
+    store_release(&r->busy, false);
+}
+
+void logger_flush() {
+
+    fflush(stdout); fflush(stderr);
+
+    if (!load_acquire(&running))
+        return;
+
+    // Con il lock il thread del logger non libera buffer mentre li scorro.
+    pthread_mutex_lock(&lock);
+
+    for (Ring_t* r = rings; r != NULL; r = r->next) {
+
+        unsigned long tail = load_acquire(&r->tail);
+
+        while ((long)(tail - load_acquire(&r->head)) > 0)
+            pause_short(IDLE_MIN_NS);
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+void logger_exit() {
+
+    Ring_t *r, *next;
+
+    if (!running)
+        return;
+
+    // Prima fermo i produttori: da qui scrivono in modo sincrono, e quelli
+    // che hanno già visto running terminano il loro record.
+    __atomic_store_n(&running, false, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_lock(&lock);
+
+    for (r = rings; r != NULL; r = r->next)
+        while (__atomic_load_n(&r->busy, __ATOMIC_SEQ_CST))
+            sched_yield();
+
+    pthread_mutex_unlock(&lock);
+
+    store_release(&stopping, true);
+    THREAD_ERR(pthread_join(tid, NULL), "logger_exit: pthread_join", )
+
+    drain();
+
+    // Libero i buffer dei thread terminati e il mio; quelli dei thread ancora
+    // vivi, che potrebbero ancora leggerne il flag busy, vengono soltanto
+    // staccati: li libera il loro thread (ring_get o ring_orphan), visto
+    // che appartengono ad una generazione passata.
+    pthread_mutex_lock(&lock);
+
+    for (r = rings; r != NULL; r = next) {
+
+        next = r->next;
+        if (r->orphaned || r == ring) free(r);
+    }
+
+    rings = NULL; ring = NULL;
+    generation++;
+
+    pthread_mutex_unlock(&lock);
+
+    if (dropped > 0) {
+        fprintf(stderr, "LOGGER DROPPED %lu RECORDS\n", dropped); dropped = 0; }
+}
@@ -0,0 +1,186 @@
+#define _GNU_SOURCE
+
+/**
+ * @file shmring.c
+ * @brief Implementazione del buffer circolare in memoria condivisa.
+ *
+ * @author Alessio Bardelli 544270
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore
+ */
+
+#include <shmring.h>
+#include <signal.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define load_acquire(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+// Il buffer è condiviso tra processi: futex non private.
+static int futex_wait(int* addr, int val, const struct timespec* timeout) { return syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0); }
+static int futex_wake(int* addr, int n) { return syscall(SYS_futex, addr, FUTEX_WAKE, n, NULL, NULL, 0); }
+
+/**
+ * @function consumer_gone
+ * @return true se il consumatore ha chiuso il buffer o è terminato.
+ */
+static int consumer_gone(ShmRing_t* ring) {
+
+    return load_acquire(&ring->closed) || (kill(ring->consumer, 0) == -1 && errno == ESRCH);
+}
+
+ShmRing_t* shmring_create(int size, int* memfd) {
+
+    ShmRing_t* ring; size_t len;
+
+    if (size < 2 || (size & (size - 1)) != 0) {
+        errno = EINVAL; return NULL; }
+
+    len = sizeof(ShmRing_t) + (size_t)size * sizeof(ShmCell_t);
+
+    MENO1(*memfd = memfd_create("OOB-shmring", 0), "shmring_create: memfd_create", return NULL)
+    MENO1(ftruncate(*memfd, len), "shmring_create: ftruncate", close(*memfd); return NULL)
+
+    if ((ring = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, *memfd, 0)) == MAP_FAILED) {
+        perror("shmring_create: mmap"); close(*memfd); return NULL; }
+
+    // Il memfd nasce azzerato: basta numerare le celle. Il consumatore
+    // parte in attesa, così la prima stima viene notificata.
+    ring->size = size; ring->waiting = true; ring->consumer = getpid();
+
+    for (int i = 0; i < size; i++)
+        ring->cell[i].seq = i;
+
+    return ring;
+}
+
+ShmRing_t* shmring_attach(int memfd) {
+
+    struct stat st; ShmRing_t* ring;
+
+    MENO1(fstat(memfd, &st), "shmring_attach: fstat", return NULL)
+
+    if ((size_t)st.st_size < sizeof(ShmRing_t)) {
+        errno = EINVAL; return NULL; }
+
+    if ((ring = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0)) == MAP_FAILED) {
+        perror("shmring_attach: mmap"); return NULL; }
+
+    if (sizeof(ShmRing_t) + ring->size * sizeof(ShmCell_t) != (size_t)st.st_size) {
+        munmap(ring, st.st_size); errno = EINVAL; return NULL; }
+
+    return ring;
+}
+
+void shmring_detach(ShmRing_t* ring) {
+
+    if (ring)
+        munmap(ring, sizeof(ShmRing_t) + ring->size * sizeof(ShmCell_t));
+}
+
+void shmring_close(ShmRing_t* ring) {
+
+    store_release(&ring->closed, true);
+
+    __atomic_add_fetch(&ring->space, 1, __ATOMIC_SEQ_CST);
+    futex_wake(&ring->space, INT_MAX);
+}
+
+int shmring_push(ShmRing_t* ring, int efd, long long int id, int stima, long timeout_ms) {
+
+    uint64_t pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED), one = 1, deadline = 0; ShmCell_t* cell; int64_t dif;
+    struct timespec ts = { SHMRING_POLL_MS / 1000, (SHMRING_POLL_MS % 1000) * NSEC_PER_MSEC }; int epoch;
+
+    // Riservo una cella come nella coda di Vyukov: è mia se il suo seq vale pos.
+    while (true) {
+
+        cell = &ring->cell[pos & (ring->size - 1)];
+        dif = (int64_t)(load_acquire(&cell->seq) - pos);
+
+        if (dif == 0 && __atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+
+        else if (dif > 0)
+            pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+        // Buffer pieno: attendo che il consumatore liberi una cella, ricontrollando
+        // ogni SHMRING_POLL_MS che ci sia ancora e che non sia scaduto il tempo.
+        else if (dif < 0) {
+
+            if (consumer_gone(ring)) {
+                errno = EPIPE; return -1; }
+
+            if (timeout_ms >= 0 && deadline == 0)
+                deadline = monotonic_ns() + (uint64_t)timeout_ms * NSEC_PER_MSEC;
+
+            else if (timeout_ms >= 0 && monotonic_ns() >= deadline) {
+                errno = ETIMEDOUT; return -1; }
+
+            // Mi dichiaro in attesa prima di ricontrollare la cella: il consumatore,
+            // liberata la cella, vede blocked e incrementa space.
+            __atomic_add_fetch(&ring->blocked, 1, __ATOMIC_SEQ_CST);
+            epoch = __atomic_load_n(&ring->space, __ATOMIC_SEQ_CST);
+
+            if ((int64_t)(load_acquire(&cell->seq) - pos) < 0)
+                futex_wait(&ring->space, epoch, &ts);
+
+            __atomic_sub_fetch(&ring->blocked, 1, __ATOMIC_SEQ_CST);
+
+            pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->id = id; cell->stima = stima;
+    store_release(&cell->seq, pos + 1);
+
+    // Pubblicata la cella, controllo se il consumatore dorme: con shmring_wait
+    // almeno uno dei due vede la scrittura dell'altro.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&ring->waiting, __ATOMIC_RELAXED) && __atomic_exchange_n(&ring->waiting, false, __ATOMIC_RELAXED))
+        MENO1(write(efd, &one, sizeof(one)), "shmring_push: write", )
+
+    return 0;
+}
+
+int shmring_pop(ShmRing_t* ring, long long int* id, int* stima) {
+
+    uint64_t head = ring->head; ShmCell_t* cell = &ring->cell[head & (ring->size - 1)];
+
+    if (load_acquire(&cell->seq) != head + 1)
+        return 0;
+
+    *id = cell->id; *stima = cell->stima;
+
+    // La cella torna libera per il giro successivo.
+    store_release(&cell->seq, head + ring->size);
+    ring->head = head + 1;
+
+    // Sveglio i produttori in attesa di spazio (vedi shmring_push).
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&ring->blocked, __ATOMIC_RELAXED) > 0) {
+
+        __atomic_add_fetch(&ring->space, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&ring->space, INT_MAX);
+    }
+
+    return 1;
+}
+
+int shmring_wait(ShmRing_t* ring) {
+
+    __atomic_store_n(&ring->waiting, true, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (load_acquire(&ring->cell[ring->head & (ring->size - 1)].seq) != ring->head + 1)
+        return 0;
+
+    __atomic_store_n(&ring->waiting, false, __ATOMIC_RELAXED);
+    return 1;
+}
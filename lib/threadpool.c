@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 /**
  * @file threadpool.c
  * @brief Implementazione del threadpool definito nella rispettiva interfaccia.
@@ -9,6 +11,28 @@
  */
 
 #include <threadpool.h>
+#include <sched.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define load_acquire(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+#define SPIN_COUNT 64 // Tentativi di prelievo prima di attendere sulla futex.
+
+// Ruota dei timer gerarchica: WHEEL_LEVELS livelli di WHEEL_SLOTS slot, tick di 1 ms.
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+
+// Identificatore di un timer: generazione dello slot e indice dello slot.
+#define TIMER_INDEX_BITS 24
+#define TIMER_GEN_MASK 0x3fffff
+
+// Incremento di un contatore scritto da un solo thread e letto senza lock da threadpool_stats.
+#define stat_inc(p) __atomic_store_n((p), *(p) + 1, __ATOMIC_RELAXED)
 
 typedef enum {
 
@@ -24,9 +48,114 @@ typedef struct {
 
     void (*function) (void*);
     void* argument;
+    uint64_t enqueued;      /**< Istante di inserimento in coda (ns), solo nei pool elastici o con statistiche. */
 
 } threadpool_task_t;
 
+/**
+ *  @struct threadpool_cell_t
+ *  @brief Cella della coda lockfree: il numero di sequenza dice se la
+ *         cella è libera per il produttore (seq == pos) o pronta per
+ *         il consumatore (seq == pos + 1).
+ */
+typedef struct {
+
+    unsigned long seq;
+    threadpool_task_t task;
+
+} threadpool_cell_t;
+
+/**
+ *  @struct threadpool_deque_t
+ *  @brief Deque di Chase-Lev, di dimensione fissa: il worker proprietario
+ *         inserisce e preleva dal fondo (bottom), gli altri rubano dalla
+ *         cima (top).
+ */
+typedef struct {
+
+    long top;
+    char pad[64];
+    long bottom;
+    threadpool_task_t* buffer;
+
+} threadpool_deque_t;
+
+/**
+ *  @enum threadpool_worker_state_t
+ *  @brief Stato dello slot di un worker: un worker che si ritira lascia
+ *         lo slot in worker_exited finché il suo thread non viene raccolto.
+ */
+typedef enum {
+
+    worker_free    = 0,
+    worker_running = 1,
+    worker_exited  = 2
+
+} threadpool_worker_state_t;
+
+/**
+ *  @struct threadpool_worker_t
+ *  @brief Stato privato di un worker.
+ */
+typedef struct {
+
+    threadpool_t* pool;
+    int id;
+    threadpool_worker_state_t state;
+    unsigned int seed;          /**< Stato del generatore per la scelta delle vittime. */
+    threadpool_deque_t deque;   /**< Deque del worker (solo work stealing). */
+
+    // Contatori del worker, scritti solo dal worker stesso: threadpool_stats
+    // li somma senza lock. Restano nello slot anche dopo il ritiro del worker.
+    unsigned long completed;
+    unsigned long wait_hist[THREADPOOL_HIST_BUCKETS];
+    unsigned long run_hist[THREADPOOL_HIST_BUCKETS];
+
+} threadpool_worker_t;
+
+/**
+ *  @struct threadpool_timer_t
+ *  @brief Timer della ruota, collegato agli altri dello stesso slot per indice,
+ *         in modo che l'array dei timer possa crescere con una realloc.
+ */
+typedef struct {
+
+    void (*function) (void*);   /**< Task da sottomettere, NULL se lo slot è libero. */
+    void* argument;
+    uint64_t expires;           /**< Tick di scadenza. */
+    uint64_t period;            /**< Periodo in tick, 0 per un timer singolo. */
+    unsigned int gen;           /**< Generazione dello slot, invalida gli identificatori vecchi. */
+    int level, slot;            /**< Posizione nella ruota. */
+    int prev, next;             /**< Lista dello slot (next anche per la lista libera). */
+
+} threadpool_timer_t;
+
+/**
+ *  @struct threadpool_wheel_t
+ *  @brief Ruota dei timer di un pool, creata al primo timer e protetta da tlock.
+ */
+typedef struct {
+
+    int wheel[WHEEL_LEVELS][WHEEL_SLOTS];   /**< Primo timer di ogni slot, -1 se vuoto. */
+    uint64_t bitmap[WHEEL_LEVELS];          /**< Slot non vuoti di ogni livello. */
+    uint64_t base;                          /**< Istante (ns) del tick 0. */
+    uint64_t cur;                           /**< Ultimo tick elaborato. */
+
+    threadpool_timer_t* timers;
+    int ntimers;
+    int free;                               /**< Lista degli slot liberi. */
+
+    threadpool_task_t* ready;               /**< Task dei timer scaduti, da sottomettere. */
+    int nready, ready_size;
+
+    pthread_t thread;
+    boolean stop;
+
+} threadpool_wheel_t;
+
+// Worker del thread corrente, NULL se il thread non appartiene ad alcun pool.
+static __thread threadpool_worker_t* current_worker = NULL;
+
 /**
  *  @struct threadpool_t
  * 
@@ -40,6 +169,35 @@ typedef struct {
  *  @var count        Number of pending tasks
  *  @var shutdown     Flag indicating if the pool is shutting down
  *  @var started      Number of started threads
+ *  @var kind         Queue implementation (mutex or lockfree)
+ *  @var cells        Array containing the lockfree queue
+ *  @var mask         Size of the lockfree queue minus one
+ *  @var enqueue_pos  Next position to fill in the lockfree queue
+ *  @var dequeue_pos  Next position to consume in the lockfree queue
+ *  @var submitting   Number of threadpool_add in progress on the lockfree queue
+ *  @var futex        Event counter the idle lockfree workers wait on
+ *  @var idle         Number of idle workers
+ *  @var workers      Array containing the workers state, one slot per thread
+ *  @var nworkers     Number of slots used at least once, scanned by the thieves
+ *  @var not_full     Condition variable to notify the submitters waiting for space (mutex queue)
+ *  @var space        Event counter the submitters wait on for space (lockfree queue)
+ *  @var blocked      Number of submitters waiting for space in the queue
+ *  @var reject       Function called with the rejected tasks, if any
+ *  @var min_threads  Workers that never retire
+ *  @var max_threads  Maximum number of workers, length of threads and workers
+ *  @var idle_timeout_ms Idle time after which a worker above the minimum retires
+ *  @var spawn_wait_ns Queue wait after which a new worker is spawned
+ *  @var elastic      true if the number of workers can change
+ *  @var stats        true if the pool collects the timing statistics
+ *  @var submitted    Number of accepted tasks (only with stats)
+ *  @var rejected     Number of rejected tasks
+ *  @var peak         Maximum number of queued tasks seen
+ *  @var cpus         CPU of each worker slot (slot i runs on cpus[i % ncpus]), NULL if not pinned
+ *  @var ncpus        Length of cpus
+ *  @var tlock        Mutex protecting the timer wheel
+ *  @var tcond        Condition variable (CLOCK_MONOTONIC) the timer thread sleeps on
+ *  @var wheel        Timer wheel, NULL until the first timer is scheduled
+ *  @var tclosed      Flag indicating that no more timers can be scheduled
  */
 struct threadpool_t {
 
@@ -54,187 +212,1590 @@ struct threadpool_t {
     int count;
     int shutdown;
     int started;
+
+    threadpool_queue_t kind;
+    threadpool_cell_t* cells;
+    unsigned long mask;
+    char pad0[64];
+    unsigned long enqueue_pos;
+    char pad1[64];
+    unsigned long dequeue_pos;
+    char pad2[64];
+    int submitting;
+    int futex;
+    int idle;
+    threadpool_worker_t* workers;
+    int nworkers;
+
+    pthread_cond_t not_full;
+    int space;
+    int blocked;
+    threadpool_reject_t reject;
+
+    int min_threads;
+    int max_threads;
+    long idle_timeout_ms;
+    uint64_t spawn_wait_ns;
+    boolean elastic;
+
+    boolean stats;
+    char pad3[64];
+    unsigned long submitted;
+    unsigned long rejected;
+    long peak;
+
+    int* cpus;
+    int ncpus;
+
+    pthread_mutex_t tlock;
+    pthread_cond_t tcond;
+    threadpool_wheel_t* wheel;
+    boolean tclosed;
 };
 
+static int futex_wait(int* addr, int val, const struct timespec* timeout) { return syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, timeout, NULL, 0); }
+
+static int futex_wake(int* addr, int n) { return syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0); }
+
 /**
- * @function threadpool_thread
- * @brief the worker thread
- * @param threadpool the pool which own the thread
+ * @function lf_push
+ * @brief Inserisce un task nella coda lockfree.
+ * @return 0 successo, -1 se la coda è piena.
  */
-static void* threadpool_thread(void* threadpool) {
-    
-    threadpool_task_t task;
-    threadpool_t* pool = (threadpool_t*)threadpool;
+static int lf_push(threadpool_t* pool, threadpool_task_t* task) {
+
+    threadpool_cell_t* cell; long dif;
+    unsigned long pos = __atomic_load_n(&pool->enqueue_pos, __ATOMIC_RELAXED);
 
     while (true) {
 
-        pthread_mutex_lock(&(pool->lock));
+        cell = &pool->cells[pos & pool->mask];
+        dif = (long)(load_acquire(&cell->seq) - pos);
 
-        while ((pool->count == 0) && (!pool->shutdown))
-            pthread_cond_wait(&(pool->notify), &(pool->lock));
+        if (dif == 0) {
 
-        if ((pool->shutdown == immediate_shutdown) || ((pool->shutdown == graceful_shutdown) && (pool->count == 0)))
-            break;
+            if (__atomic_compare_exchange_n(&pool->enqueue_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
 
-        task.function = pool->queue[pool->head].function;
-        task.argument = pool->queue[pool->head].argument;
-        pool->head = (pool->head + 1) % pool->queue_size;
-        pool->count -= 1;
+        else if (dif < 0)
+            return -1;
 
-        pthread_mutex_unlock(&(pool->lock));
+        else
+            pos = __atomic_load_n(&pool->enqueue_pos, __ATOMIC_RELAXED);
+    }
+
+    cell->task = *task;
+    store_release(&cell->seq, pos + 1);
+
+    return 0;
+}
+
+/**
+ * @function lf_pop
+ * @brief Preleva un task dalla coda lockfree.
+ * @return 0 successo, -1 se la coda è vuota.
+ */
+static int lf_pop(threadpool_t* pool, threadpool_task_t* task) {
+
+    threadpool_cell_t* cell; long dif;
+    unsigned long pos = __atomic_load_n(&pool->dequeue_pos, __ATOMIC_RELAXED);
+
+    while (true) {
+
+        cell = &pool->cells[pos & pool->mask];
+        dif = (long)(load_acquire(&cell->seq) - (pos + 1));
 
-        (*(task.function))(task.argument);
+        if (dif == 0) {
+
+            if (__atomic_compare_exchange_n(&pool->dequeue_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+
+        else if (dif < 0)
+            return -1;
+
+        else
+            pos = __atomic_load_n(&pool->dequeue_pos, __ATOMIC_RELAXED);
     }
 
-    pool->started--;
+    *task = cell->task;
+    store_release(&cell->seq, pos + pool->mask + 1);
 
-    pthread_mutex_unlock(&(pool->lock)); return NULL;
+    // La cella è di nuovo libera: sveglio chi attende di sottomettere un task.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&pool->blocked, __ATOMIC_SEQ_CST) > 0) {
+
+        __atomic_add_fetch(&pool->space, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&pool->space, INT_MAX);
+    }
+
+    return 0;
 }
 
-int threadpool_free(threadpool_t* pool) {
+/**
+ * @function lf_wake
+ * @brief Sveglia fino a @n worker in attesa sulla futex.
+ */
+static void lf_wake(threadpool_t* pool, int n) {
 
-    if (!pool || pool->started > 0)
+    __atomic_add_fetch(&pool->futex, 1, __ATOMIC_SEQ_CST);
+    futex_wake(&pool->futex, n);
+}
+
+/**
+ * @function deque_push
+ * @brief Inserisce un task in fondo alla deque (solo il proprietario).
+ * @return 0 successo, -1 se la deque è piena.
+ */
+static int deque_push(threadpool_deque_t* dq, unsigned long mask, threadpool_task_t* task) {
+
+    long b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED);
+    long t = load_acquire(&dq->top);
+
+    if (b - t > (long)mask)
         return -1;
 
-    if (pool->queue)
-        free(pool->queue);
+    dq->buffer[b & mask] = *task;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
 
-    if (pool->threads) {
+    return 0;
+}
 
-        free(pool->threads);
+/**
+ * @function deque_take
+ * @brief Preleva il task in fondo alla deque (solo il proprietario).
+ * @return 0 successo, -1 se la deque è vuota.
+ */
+static int deque_take(threadpool_deque_t* dq, unsigned long mask, threadpool_task_t* task) {
 
-        pthread_mutex_lock(&(pool->lock));
-        pthread_mutex_destroy(&(pool->lock));
-        pthread_cond_destroy(&(pool->notify));
+    long b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED) - 1, t; int res = 0;
+
+    __atomic_store_n(&dq->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t = __atomic_load_n(&dq->top, __ATOMIC_RELAXED);
+
+    if (t > b) {
+        __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED); return -1; }
+
+    *task = dq->buffer[b & mask];
+
+    // Ultimo elemento: lo contendo ai ladri tramite la cima.
+    if (t == b) {
+
+        if (!__atomic_compare_exchange_n(&dq->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            res = -1;
+
+        __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
     }
 
-    free(pool); return 0;
+    return res;
 }
 
-threadpool_t* threadpool_create(int thread_count, int queue_size) {
-    
-    threadpool_t* pool = NULL; int i;
+/**
+ * @function deque_steal
+ * @brief Ruba il task in cima alla deque di un altro worker.
+ * @return 0 successo, -1 se la deque è vuota o il furto è fallito.
+ */
+static int deque_steal(threadpool_deque_t* dq, unsigned long mask, threadpool_task_t* task) {
 
-    if (thread_count <= 0 || thread_count > MAX_THREADS || queue_size <= 0 || queue_size > MAX_QUEUE)
-        return NULL;
-    
-    REALLOC(pool, sizeof(threadpool_t), "threadpool_create: realloc", goto err)
+    long t = load_acquire(&dq->top), b;
 
-    pool->thread_count = 0;
-    pool->queue_size = queue_size;
-    pool->head = pool->tail = pool->count = 0;
-    pool->shutdown = pool->started = 0;
-    pool->threads = NULL; pool->queue = NULL;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    b = load_acquire(&dq->bottom);
 
-    REALLOC(pool->threads, sizeof(pthread_t) * thread_count, "threadpool_create: realloc 1", goto err)
-    REALLOC(pool->queue, sizeof(threadpool_task_t) * queue_size, "threadpool_create: realloc 2", goto err)
+    if (t >= b)
+        return -1;
 
-    THREAD_ERR(pthread_mutex_init(&(pool->lock), NULL), "threadpool_create: pthread_mutex_init", goto err)
-    THREAD_ERR(pthread_cond_init(&(pool->notify), NULL), "threadpool_create: pthread_cond_init", goto err)
+    *task = dq->buffer[t & mask];
 
-    for (i = 0; i < thread_count; i++) {
+    if (!__atomic_compare_exchange_n(&dq->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return -1;
 
-        THREAD_ERR (
-            pthread_create(&(pool->threads[i]), NULL, threadpool_thread, (void*)pool),
-            "threadpool_create: pthread_create",
-            threadpool_destroy(pool, 0); return NULL
-        )
+    return 0;
+}
 
-        pool->thread_count++;
-        pool->started++;
-    }
+/**
+ * @function worker_find
+ * @brief Cerca un task per il worker: nei pool work stealing prima nella
+ *        propria deque, poi nella coda condivisa, infine nelle deque di
+ *        altri worker, a partire da una vittima scelta a caso.
+ * @return 0 se ha trovato un task, -1 altrimenti.
+ */
+static int worker_find(threadpool_worker_t* worker, threadpool_task_t* task) {
 
-    return pool;
+    threadpool_t* pool = worker->pool; int n = load_acquire(&pool->nworkers), victim;
 
-    err: {
-     
-        if (pool)
-            threadpool_free(pool);
-        
-        return NULL;
+    if (pool->kind != threadpool_queue_stealing)
+        return lf_pop(pool, task);
+
+    if (deque_take(&worker->deque, pool->mask, task) == 0 || lf_pop(pool, task) == 0)
+        return 0;
+
+    victim = rand_r(&worker->seed) % n;
+
+    for (int i = 0; i < n; i++, victim = (victim + 1) % n)
+        if (victim != worker->id && deque_steal(&pool->workers[victim].deque, pool->mask, task) == 0)
+            return 0;
+
+    return -1;
+}
+
+/**
+ * @function deadline_after
+ * @brief Calcola in @ts l'istante (CLOCK_REALTIME, come richiesto
+ *        da pthread_cond_timedwait) che segue di @ms millisecondi quello corrente.
+ */
+static void deadline_after(struct timespec* ts, long ms) {
+
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec += ms / 1000; ts->tv_nsec += (ms % 1000) * NSEC_PER_MSEC;
+    if (ts->tv_nsec >= NSEC_PER_SEC) { ts->tv_sec++; ts->tv_nsec -= NSEC_PER_SEC; }
+}
+
+/**
+ * @function lf_depth
+ * @return Numero (approssimato) di task nella coda lockfree.
+ */
+static long lf_depth(threadpool_t* pool) {
+
+    return (long)(__atomic_load_n(&pool->enqueue_pos, __ATOMIC_RELAXED) - __atomic_load_n(&pool->dequeue_pos, __ATOMIC_RELAXED));
+}
+
+/**
+ * @function hist_bucket
+ * @return Il bucket dell'istogramma per una durata di @ns nanosecondi:
+ *         il bucket i conta le durate in [2^i, 2^(i+1)), l'ultimo anche le maggiori.
+ */
+static int hist_bucket(uint64_t ns) {
+
+    int b = ns ? 63 - __builtin_clzll(ns) : 0;
+
+    return (b < THREADPOOL_HIST_BUCKETS) ? b : THREADPOOL_HIST_BUCKETS - 1;
+}
+
+/**
+ * @function stat_max
+ * @brief Aggiorna il massimo numero di task in coda osservato.
+ */
+static void stat_max(long* peak, long depth) {
+
+    long cur = __atomic_load_n(peak, __ATOMIC_RELAXED);
+
+    while (depth > cur && !__atomic_compare_exchange_n(peak, &cur, depth, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/**
+ * @function worker_run
+ * @brief Esegue il task; se il pool raccoglie le statistiche registra
+ *        l'attesa in coda e la durata negli istogrammi del worker.
+ */
+static void worker_run(threadpool_worker_t* worker, threadpool_task_t* task) {
+
+    uint64_t start;
+
+    if (!worker->pool->stats)
+        (*(task->function))(task->argument);
+
+    else {
+
+        start = monotonic_ns();
+        stat_inc(&worker->wait_hist[hist_bucket(start - task->enqueued)]);
+
+        (*(task->function))(task->argument);
+
+        stat_inc(&worker->run_hist[hist_bucket(monotonic_ns() - start)]);
     }
+
+    stat_inc(&worker->completed);
 }
 
-int threadpool_add(threadpool_t* pool, void (*function) (void*), void* argument) {
+/**
+ * @function threadpool_starving
+ * @brief Dice se un pool elastico ha bisogno di un worker in più: nessuno
+ *        è inattivo, non si è raggiunto il massimo e in coda ci sono almeno
+ *        tanti task quanti worker, oppure l'ultimo task prelevato ha atteso
+ *        in coda più di spawn_wait.
+ * @param depth  Numero di task in coda.
+ * @param waited Attesa in coda, in ns, dell'ultimo task prelevato (0 se non nota).
+ */
+static boolean threadpool_starving(threadpool_t* pool, long depth, uint64_t waited) {
+
+    int count = __atomic_load_n(&pool->thread_count, __ATOMIC_RELAXED);
+
+    return pool->elastic && __atomic_load_n(&pool->idle, __ATOMIC_RELAXED) == 0 && count < pool->max_threads &&
+           (depth >= count || (depth > 0 && pool->spawn_wait_ns > 0 && waited > pool->spawn_wait_ns));
+}
+
+static void* threadpool_thread(void* worker);
+static void* threadpool_thread_lf(void* worker);
+
+/**
+ * @function threadpool_spawn
+ * @brief Avvia un nuovo worker nel primo slot libero, raccogliendo prima
+ *        il thread che lo occupava se si è ritirato. Dopo threadpool_destroy
+ *        non avvia più nulla: quel worker non verrebbe raccolto.
+ *        Va chiamata con il lock del pool acquisito.
+ * @return 0 successo, -1 altrimenti.
+ */
+static int threadpool_spawn(threadpool_t* pool) {
 
-    int next = 0;
+    threadpool_worker_t* worker = NULL; int i; pthread_attr_t attr; cpu_set_t set;
 
-    if (!pool || !function)
+    if (pool->shutdown)
         return -1;
 
-    THREAD_ERR (
-        pthread_mutex_lock(&(pool->lock)), 
-        "threadpool_add: pthread_mutex_lock", 
-        return -1
-    )
+    for (i = 0; i < pool->max_threads; i++)
+        if (pool->workers[i].state != worker_running) {
+            worker = &pool->workers[i]; break; }
+
+    if (!worker)
+        return -1;
+
+    // Con una politica di affinità il worker nasce già sulla CPU del suo slot.
+    THREAD_ERR(pthread_attr_init(&attr), "threadpool_spawn: pthread_attr_init", return -1)
 
-    next = (pool->tail + 1) % pool->queue_size;
+    if (pool->cpus) {
 
-    if (pool->count == pool->queue_size) {
-        fprintf(stderr, "threadpool_add: queue full\n");
-        pthread_mutex_unlock(&(pool->lock)); return -1; 
+        CPU_ZERO(&set); CPU_SET(pool->cpus[i % pool->ncpus], &set);
+        THREAD_ERR(pthread_attr_setaffinity_np(&attr, sizeof(set), &set), "threadpool_spawn: pthread_attr_setaffinity_np", )
     }
 
-    if (pool->shutdown) {
-        fprintf(stderr, "threadpool_add: pool shutdown\n");
-        pthread_mutex_unlock(&(pool->lock)); return -1; 
+    if (worker->state == worker_exited) {
+
+        THREAD_ERR(pthread_join(pool->threads[i], NULL), "threadpool_spawn: pthread_join", )
+        worker->state = worker_free;
     }
 
-    pool->queue[pool->tail].function = function;
-    pool->queue[pool->tail].argument = argument;
-    pool->tail = next;
-    pool->count += 1;
+    if (pool->kind == threadpool_queue_stealing && !worker->deque.buffer)
+        CALLOC(worker->deque.buffer, pool->queue_size, sizeof(threadpool_task_t), "threadpool_spawn: calloc", pthread_attr_destroy(&attr); return -1)
 
-    THREAD_ERR (
-        pthread_cond_signal(&(pool->notify)),
-        "threadpool_add: signal",
-        pthread_mutex_unlock(&(pool->lock)); return -1;
-    )
+    // I ladri scorrono soltanto gli slot usati almeno una volta.
+    if (i >= pool->nworkers)
+        store_release(&pool->nworkers, i + 1);
+
+    worker->state = worker_running;
+    __atomic_add_fetch(&pool->thread_count, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&pool->started, 1, __ATOMIC_SEQ_CST);
 
     THREAD_ERR (
-        pthread_mutex_unlock(&(pool->lock)),
-        "threadpool_add: unlock",
-        return -1;
+        pthread_create(&(pool->threads[i]), &attr, (pool->kind == threadpool_queue_mutex) ?
+            threadpool_thread : threadpool_thread_lf, (void*)worker),
+        "threadpool_spawn: pthread_create",
+        worker->state = worker_free;
+        __atomic_sub_fetch(&pool->thread_count, 1, __ATOMIC_SEQ_CST);
+        __atomic_sub_fetch(&pool->started, 1, __ATOMIC_SEQ_CST);
+        pthread_attr_destroy(&attr); return -1
     )
-    
+
+    pthread_attr_destroy(&attr);
+
     return 0;
 }
 
-int threadpool_destroy(threadpool_t* pool, int flags) {
+/**
+ * @function threadpool_grow
+ * @brief Aggiunge un worker ad un pool lockfree o work stealing elastico.
+ *        Se il lock è occupato rinuncia: la crescita è solo un'ottimizzazione
+ *        e non deve bloccare chi sottomette (né threadpool_destroy, che
+ *        tiene il lock mentre attende le aggiunte in corso). Fa eccezione
+ *        il pool senza worker (min_threads 0): lì insiste finché il lock
+ *        non si libera, altrimenti il task appena inserito resterebbe in coda.
+ */
+static void threadpool_grow(threadpool_t* pool) {
 
-    if (!pool) return -1;
+    while (pthread_mutex_trylock(&(pool->lock)) != 0) {
 
-    THREAD_ERR (
-        pthread_mutex_lock(&(pool->lock)),
-        "threadpool_destroy: pthread_mutex_lock",
-        return -1
-    )
-        
-    if (pool->shutdown) {
-        fprintf(stderr, "threadpool_destroy: pool already shutdown\n");
-        return -1;
+        if (__atomic_load_n(&pool->thread_count, __ATOMIC_SEQ_CST) > 0 || __atomic_load_n(&pool->shutdown, __ATOMIC_SEQ_CST))
+            return;
+
+        sched_yield();
     }
 
-    pool->shutdown = (flags & threadpool_graceful) ?
-        graceful_shutdown : immediate_shutdown;
+    if (pool->thread_count < pool->max_threads)
+        threadpool_spawn(pool);
 
-    THREAD_ERR (
-        pthread_cond_broadcast(&(pool->notify)),
-        "threadpool_destroy: broadcast",
-        return -1;
-    )
+    pthread_mutex_unlock(&(pool->lock));
+}
 
-    THREAD_ERR (
-        pthread_mutex_unlock(&(pool->lock)),
-        "threadpool_destroy: pthread_mutex_unlock",
-        return -1;
-    )
-        
-    for (int i = 0; i < pool->thread_count; i++) {
-        THREAD_ERR (
-            pthread_join(pool->threads[i], NULL),
-            "threadpool_destroy: pthread_join",
-        ) }
+/**
+ * @function threadpool_retire
+ * @brief Ritira il worker se il pool ne ha più del minimo: il thread
+ *        verrà raccolto da threadpool_spawn o da threadpool_destroy.
+ *        Va chiamata con il lock del pool acquisito.
+ * @return true se il worker deve terminare.
+ */
+static boolean threadpool_retire(threadpool_worker_t* worker) {
 
-    threadpool_free(pool); return 0;
+    threadpool_t* pool = worker->pool;
+
+    if (pool->shutdown || pool->thread_count <= pool->min_threads)
+        return false;
+
+    // L'ultimo worker di un pool lockfree resta se nel frattempo è arrivato un task:
+    // chi l'ha inserito, letto il vecchio numero di worker, non ne ha avviato uno nuovo.
+    if (__atomic_sub_fetch(&pool->thread_count, 1, __ATOMIC_SEQ_CST) == 0 &&
+            pool->kind != threadpool_queue_mutex && lf_depth(pool) > 0) {
+
+        __atomic_add_fetch(&pool->thread_count, 1, __ATOMIC_SEQ_CST); return false; }
+
+    worker->state = worker_exited;
+
+    return true;
+}
+
+/**
+ * @function threadpool_thread_lf
+ * @brief the worker thread of a pool with the lockfree or work stealing queue
+ * @param worker the state of the worker, which points to the pool
+ */
+static void* threadpool_thread_lf(void* worker) {
+
+    threadpool_task_t task; boolean found, timedout, retired; int epoch; struct timespec ts;
+    threadpool_t* pool = ((threadpool_worker_t*)worker)->pool;
+
+    current_worker = (threadpool_worker_t*)worker;
+
+    while (true) {
+
+        // Provo a prelevare un task, insistendo per qualche giro prima di attendere.
+        found = (worker_find(worker, &task) == 0);
+
+        for (int i = 0; !found && i < SPIN_COUNT; i++) {
+            sched_yield(); found = (worker_find(worker, &task) == 0); }
+
+        if (!found) {
+
+            // A coda vuota la terminazione graceful equivale a quella immediata.
+            if (__atomic_load_n(&pool->shutdown, __ATOMIC_SEQ_CST))
+                break;
+
+            // Mi dichiaro inattivo e leggo il contatore prima di ricontrollare
+            // la coda: un task inserito dopo il controllo incrementa il contatore,
+            // per cui la futex_wait ritorna subito invece di perdere il risveglio.
+            __atomic_add_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+            epoch = __atomic_load_n(&pool->futex, __ATOMIC_SEQ_CST);
+
+            found = (worker_find(worker, &task) == 0); timedout = false;
+
+            // Oltre il minimo di worker l'attesa è limitata.
+            if (!found && !__atomic_load_n(&pool->shutdown, __ATOMIC_SEQ_CST)) {
+
+                if (pool->idle_timeout_ms > 0 && __atomic_load_n(&pool->thread_count, __ATOMIC_SEQ_CST) > pool->min_threads) {
+
+                    ts.tv_sec = pool->idle_timeout_ms / 1000; ts.tv_nsec = (pool->idle_timeout_ms % 1000) * NSEC_PER_MSEC;
+                    timedout = (futex_wait(&pool->futex, epoch, &ts) == -1 && errno == ETIMEDOUT);
+                }
+
+                else
+                    futex_wait(&pool->futex, epoch, NULL);
+            }
+
+            __atomic_sub_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+
+            // Allo scadere dell'attesa mi ritiro, a meno che nel frattempo non sia arrivato un task.
+            if (timedout && (found = (worker_find(worker, &task) == 0)) == false) {
+
+                pthread_mutex_lock(&(pool->lock));
+                retired = threadpool_retire(worker);
+                pthread_mutex_unlock(&(pool->lock));
+
+                if (retired)
+                    break;
+            }
+
+            if (!found)
+                continue;
+        }
+
+        if (__atomic_load_n(&pool->shutdown, __ATOMIC_SEQ_CST) == immediate_shutdown)
+            break;
+
+        if (pool->elastic && threadpool_starving(pool, lf_depth(pool), monotonic_ns() - task.enqueued))
+            threadpool_grow(pool);
+
+        worker_run(worker, &task);
+    }
+
+    __atomic_sub_fetch(&pool->started, 1, __ATOMIC_SEQ_CST);
+
+    current_worker = NULL; return NULL;
+}
+
+
+/**
+ * @function threadpool_thread
+ * @brief the worker thread
+ * @param worker the state of the worker, which points to the pool
+ */
+static void* threadpool_thread(void* worker) {
+    
+    threadpool_task_t task; int err; struct timespec deadline;
+    threadpool_t* pool = ((threadpool_worker_t*)worker)->pool;
+
+    current_worker = (threadpool_worker_t*)worker;
+
+    while (true) {
+
+        pthread_mutex_lock(&(pool->lock));
+
+        while ((pool->count == 0) && (!pool->shutdown)) {
+
+            __atomic_add_fetch(&pool->idle, 1, __ATOMIC_RELAXED);
+
+            // Oltre il minimo di worker l'attesa è limitata:
+            // allo scadere, se la coda è ancora vuota, il worker si ritira.
+            if (pool->idle_timeout_ms > 0 && pool->thread_count > pool->min_threads) {
+
+                deadline_after(&deadline, pool->idle_timeout_ms);
+                err = pthread_cond_timedwait(&(pool->notify), &(pool->lock), &deadline);
+            }
+
+            else
+                err = pthread_cond_wait(&(pool->notify), &(pool->lock));
+
+            __atomic_sub_fetch(&pool->idle, 1, __ATOMIC_RELAXED);
+
+            if (err == ETIMEDOUT && pool->count == 0 && threadpool_retire(worker)) {
+
+                pool->started--; current_worker = NULL;
+                pthread_mutex_unlock(&(pool->lock)); return NULL;
+            }
+        }
+
+        if ((pool->shutdown == immediate_shutdown) || ((pool->shutdown == graceful_shutdown) && (pool->count == 0)))
+            break;
+
+        task = pool->queue[pool->head];
+        pool->head = (pool->head + 1) % pool->queue_size;
+        pool->count -= 1;
+
+        if (pool->blocked > 0)
+            pthread_cond_signal(&(pool->not_full));
+
+        if (pool->elastic && threadpool_starving(pool, pool->count, monotonic_ns() - task.enqueued))
+            threadpool_spawn(pool);
+
+        pthread_mutex_unlock(&(pool->lock));
+
+        worker_run(worker, &task);
+    }
+
+    pool->started--; current_worker = NULL;
+
+    pthread_mutex_unlock(&(pool->lock)); return NULL;
+}
+
+int threadpool_free(threadpool_t* pool) {
+
+    if (!pool || pool->started > 0)
+        return -1;
+
+    if (pool->queue)
+        free(pool->queue);
+
+    if (pool->cells)
+        free(pool->cells);
+
+    if (pool->cpus)
+        free(pool->cpus);
+
+    if (pool->workers) {
+
+        for (int i = 0; i < pool->max_threads; i++)
+            if (pool->workers[i].deque.buffer)
+                free(pool->workers[i].deque.buffer);
+
+        free(pool->workers);
+    }
+
+    if (pool->threads) {
+
+        free(pool->threads);
+
+        pthread_mutex_lock(&(pool->lock));
+        pthread_mutex_destroy(&(pool->lock));
+        pthread_cond_destroy(&(pool->notify));
+        pthread_cond_destroy(&(pool->not_full));
+        pthread_mutex_destroy(&(pool->tlock));
+        pthread_cond_destroy(&(pool->tcond));
+    }
+
+    free(pool); return 0;
+}
+
+/**
+ *  @struct cpu_info_t
+ *  @brief Posizione di una CPU nella topologia della macchina.
+ */
+typedef struct {
+
+    int cpu;    /**< Numero della CPU. */
+    int node;   /**< Nodo NUMA. */
+    long core;  /**< Core fisico (package e core_id). */
+    int rank;   /**< Indice tra i thread hardware dello stesso core. */
+    int pos;    /**< Indice del core tra quelli del suo nodo. */
+
+} cpu_info_t;
+
+/**
+ * @function sysfs_long
+ * @return Il numero contenuto nel file @path, @def se non è leggibile.
+ */
+static long sysfs_long(const char* path, long def) {
+
+    FILE* file; long value;
+
+    if ((file = fopen(path, "r")) == NULL)
+        return def;
+
+    if (fscanf(file, "%ld", &value) != 1)
+        value = def;
+
+    fclose(file); return value;
+}
+
+/**
+ * @function cpu_nodes
+ * @brief Assegna a @node[cpu] il nodo NUMA di ogni CPU, leggendo le cpulist
+ *        dei nodi ("0-3,8-11"); senza sysfs tutte le CPU restano sul nodo 0.
+ */
+static void cpu_nodes(int* node, int n) {
+
+    DIR* dir; struct dirent* entry; FILE* file; char path[300]; int id, lo, hi; char sep;
+
+    if ((dir = opendir("/sys/devices/system/node")) == NULL)
+        return;
+
+    while ((entry = readdir(dir)) != NULL) {
+
+        if (sscanf(entry->d_name, "node%d", &id) != 1)
+            continue;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/node/%s/cpulist", entry->d_name);
+
+        if ((file = fopen(path, "r")) == NULL)
+            continue;
+
+        while (fscanf(file, "%d", &lo) == 1) {
+
+            hi = lo;
+
+            if ((sep = fgetc(file)) == '-') {
+                if (fscanf(file, "%d", &hi) != 1) break;
+                sep = fgetc(file); }
+
+            for (int c = lo; c <= hi && c < n; c++)
+                if (c >= 0) node[c] = id;
+
+            if (sep != ',')
+                break;
+        }
+
+        fclose(file);
+    }
+
+    closedir(dir);
+}
+
+static int cmp_compact(const void* a, const void* b) {
+
+    const cpu_info_t *x = a, *y = b;
+
+    if (x->node != y->node) return x->node - y->node;
+    if (x->core != y->core) return (x->core < y->core) ? -1 : 1;
+    return x->cpu - y->cpu;
+}
+
+static int cmp_scatter(const void* a, const void* b) {
+
+    const cpu_info_t *x = a, *y = b;
+
+    if (x->rank != y->rank) return x->rank - y->rank;
+    if (x->pos != y->pos) return x->pos - y->pos;
+    if (x->node != y->node) return x->node - y->node;
+    return x->cpu - y->cpu;
+}
+
+int threadpool_cpus(threadpool_affinity_t policy, int* cpus, int max) {
+
+    cpu_set_t allowed; cpu_info_t* info = NULL; int* node = NULL; int n = 0; char path[128];
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1)
+        return -1;
+
+    // Solo compact e scatter dipendono dalla topologia: le altre politiche
+    // vogliono le CPU in ordine di numero, senza leggere /sys.
+    if (policy != threadpool_affinity_compact && policy != threadpool_affinity_scatter) {
+
+        for (int c = 0; c < CPU_SETSIZE && n < max; c++)
+            if (CPU_ISSET(c, &allowed)) cpus[n++] = c;
+
+        return n;
+    }
+
+    CALLOC(info, CPU_SETSIZE, sizeof(cpu_info_t), "threadpool_cpus: calloc", return -1)
+    CALLOC(node, CPU_SETSIZE, sizeof(int), "threadpool_cpus: calloc", free(info); return -1)
+
+    cpu_nodes(node, CPU_SETSIZE);
+
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+
+        if (!CPU_ISSET(c, &allowed))
+            continue;
+
+        info[n].cpu = c; info[n].node = node[c];
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", c);
+        info[n].core = sysfs_long(path, 0) << 20;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", c);
+        info[n].core |= sysfs_long(path, c);
+
+        // Le CPU precedenti dello stesso core sono i thread hardware gemelli,
+        // quelle dello stesso nodo con un altro core ne danno la posizione.
+        for (int j = 0; j < n; j++) {
+
+            if (info[j].core == info[n].core) {
+                info[n].rank++; info[n].pos = info[j].pos; }
+
+            else if (info[j].node == info[n].node && info[j].rank == 0 && info[n].rank == 0)
+                info[n].pos++;
+        }
+
+        n++;
+    }
+
+    qsort(info, n, sizeof(cpu_info_t), (policy == threadpool_affinity_compact) ? cmp_compact : cmp_scatter);
+
+    if (n > max)
+        n = max;
+
+    for (int i = 0; i < n; i++)
+        cpus[i] = info[i].cpu;
+
+    free(info); free(node); return n;
+}
+
+int threadpool_bind_process(const int* cpus, int n) {
+
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+
+    for (int i = 0; i < n; i++)
+        if (cpus[i] >= 0 && cpus[i] < CPU_SETSIZE)
+            CPU_SET(cpus[i], &set);
+
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+
+void threadpool_attr_init(threadpool_attr_t* attr, int thread_count, int queue_size) {
+
+    attr->thread_count = thread_count;
+    attr->queue_size = queue_size;
+    attr->queue = threadpool_queue_mutex;
+    attr->reject = NULL;
+    attr->min_threads = attr->max_threads = (thread_count > 0) ? thread_count : -1;
+    attr->idle_timeout_ms = 0;
+    attr->spawn_wait_ms = 10;
+    attr->stats = false;
+    attr->affinity = threadpool_affinity_none;
+    attr->cpus = NULL; attr->ncpus = 0;
+}
+
+threadpool_t* threadpool_create(int thread_count, int queue_size) {
+
+    threadpool_attr_t attr;
+
+    threadpool_attr_init(&attr, thread_count, queue_size);
+
+    return threadpool_create_attr(&attr);
+}
+
+threadpool_t* threadpool_create_attr(const threadpool_attr_t* attr) {
+    
+    threadpool_t* pool = NULL; int i, cpus[THREADPOOL_MAX_CPUS], ncpus = 0; pthread_condattr_t cattr;
+    int thread_count = attr->thread_count, queue_size = attr->queue_size;
+
+    // CPU dei worker, secondo la politica di affinità.
+    if (attr->affinity == threadpool_affinity_list && attr->cpus && attr->ncpus > 0)
+        for (ncpus = 0; ncpus < attr->ncpus && ncpus < THREADPOOL_MAX_CPUS; ncpus++)
+            cpus[ncpus] = attr->cpus[ncpus];
+
+    else
+        ncpus = threadpool_cpus(attr->affinity, cpus, THREADPOOL_MAX_CPUS);
+
+    // Senza un numero di worker esplicito ne avvio uno per CPU.
+    if (thread_count == 0)
+        thread_count = (ncpus < 1) ? 1 : (ncpus > MAX_THREADS) ? MAX_THREADS : ncpus;
+
+    if (thread_count <= 0 || thread_count > MAX_THREADS || queue_size <= 0 || queue_size > MAX_QUEUE)
+        return NULL;
+    
+    CALLOC(pool, 1, sizeof(threadpool_t), "threadpool_create: calloc", goto err)
+
+    if (attr->affinity != threadpool_affinity_none && ncpus > 0) {
+
+        CALLOC(pool->cpus, ncpus, sizeof(int), "threadpool_create: calloc cpus", goto err)
+        memcpy(pool->cpus, cpus, ncpus * sizeof(int)); pool->ncpus = ncpus;
+    }
+
+    pool->thread_count = 0;
+    pool->queue_size = queue_size;
+    pool->head = pool->tail = pool->count = 0;
+    pool->shutdown = pool->started = 0;
+    pool->threads = NULL; pool->queue = NULL;
+    pool->kind = attr->queue; pool->cells = NULL; pool->workers = NULL; pool->nworkers = 0;
+    pool->reject = attr->reject;
+
+    // Limiti del pool elastico: il minimo non supera i worker iniziali, il massimo non è inferiore.
+    // Con minimo 0 tutti i worker possono ritirarsi: il primo task sottomesso ne riavvia uno.
+    pool->min_threads = (attr->min_threads < 0 || attr->min_threads > thread_count) ? thread_count : attr->min_threads;
+    pool->max_threads = (attr->max_threads < thread_count) ? thread_count : attr->max_threads;
+    pool->idle_timeout_ms = (attr->idle_timeout_ms > 0) ? attr->idle_timeout_ms : 0;
+    pool->spawn_wait_ns = (attr->spawn_wait_ms > 0) ? (uint64_t)attr->spawn_wait_ms * NSEC_PER_MSEC : 0;
+    pool->elastic = (pool->max_threads > pool->min_threads);
+    pool->stats = attr->stats;
+
+    REALLOC(pool->threads, sizeof(pthread_t) * pool->max_threads, "threadpool_create: realloc 1", goto err)
+    CALLOC(pool->workers, pool->max_threads, sizeof(threadpool_worker_t), "threadpool_create: calloc 2", goto err)
+
+    for (i = 0; i < pool->max_threads; i++) {
+
+        pool->workers[i].pool = pool; pool->workers[i].id = i;
+        pool->workers[i].seed = (unsigned int)(i * 2654435761u + 1);
+    }
+
+    if (pool->kind != threadpool_queue_mutex) {
+
+        // La coda lockfree e le deque indicizzano le celle con una maschera.
+        for (pool->queue_size = 1; pool->queue_size < queue_size; pool->queue_size <<= 1);
+        pool->mask = pool->queue_size - 1;
+
+        REALLOC(pool->cells, sizeof(threadpool_cell_t) * pool->queue_size, "threadpool_create: realloc 2", goto err)
+
+        for (i = 0; i < pool->queue_size; i++)
+            pool->cells[i].seq = i;
+    }
+
+    else
+        REALLOC(pool->queue, sizeof(threadpool_task_t) * queue_size, "threadpool_create: realloc 2", goto err)
+
+    THREAD_ERR(pthread_mutex_init(&(pool->lock), NULL), "threadpool_create: pthread_mutex_init", goto err)
+    THREAD_ERR(pthread_cond_init(&(pool->notify), NULL), "threadpool_create: pthread_cond_init", goto err)
+    THREAD_ERR(pthread_cond_init(&(pool->not_full), NULL), "threadpool_create: pthread_cond_init", goto err)
+    THREAD_ERR(pthread_mutex_init(&(pool->tlock), NULL), "threadpool_create: pthread_mutex_init", goto err)
+
+    // Il thread dei timer attende scadenze espresse in CLOCK_MONOTONIC.
+    pthread_condattr_init(&cattr); pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    THREAD_ERR(pthread_cond_init(&(pool->tcond), &cattr), "threadpool_create: pthread_cond_init", pthread_condattr_destroy(&cattr); goto err)
+    pthread_condattr_destroy(&cattr);
+
+    // Tengo il lock perché i worker oltre il minimo potrebbero già ritirarsi.
+    pthread_mutex_lock(&(pool->lock));
+
+    for (i = 0; i < thread_count; i++)
+        if (threadpool_spawn(pool) == -1) {
+            pthread_mutex_unlock(&(pool->lock)); threadpool_destroy(pool, 0); return NULL; }
+
+    pthread_mutex_unlock(&(pool->lock));
+
+    return pool;
+
+    err: {
+     
+        if (pool)
+            threadpool_free(pool);
+        
+        return NULL;
+    }
+}
+
+/**
+ * @function lf_submit
+ * @brief Tenta di inserire il task nella coda lockfree o, se sottomesso da
+ *        un worker dello stesso pool work stealing, nella sua deque.
+ * @return 0 successo, ECANCELED se il pool è in terminazione, EAGAIN se la coda è piena.
+ */
+static int lf_submit(threadpool_t* pool, threadpool_task_t* task) {
+
+    long depth;
+
+    if (__atomic_load_n(&pool->shutdown, __ATOMIC_SEQ_CST))
+        return ECANCELED;
+
+    if (pool->elastic || pool->stats)
+        task->enqueued = monotonic_ns();
+
+    // Se la deque del worker è piena il task finisce nella coda condivisa.
+    if (pool->kind == threadpool_queue_stealing && current_worker && current_worker->pool == pool
+            && deque_push(&current_worker->deque, pool->mask, task) == 0)
+        depth = __atomic_load_n(&current_worker->deque.bottom, __ATOMIC_RELAXED) - __atomic_load_n(&current_worker->deque.top, __ATOMIC_RELAXED);
+
+    else if (lf_push(pool, task) == -1)
+        return EAGAIN;
+
+    else
+        depth = pool->stats ? lf_depth(pool) : 0;
+
+    if (pool->stats) {
+
+        __atomic_add_fetch(&pool->submitted, 1, __ATOMIC_RELAXED);
+        stat_max(&pool->peak, depth);
+    }
+
+    // Il task deve essere visibile prima di controllare se ci sono worker inattivi.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&pool->idle, __ATOMIC_SEQ_CST) > 0)
+        lf_wake(pool, 1);
+
+    else if (pool->elastic && threadpool_starving(pool, lf_depth(pool), 0))
+        threadpool_grow(pool);
+
+    return 0;
+}
+
+/**
+ * @function threadpool_add_lf
+ * @brief threadpool_add_timed per la coda lockfree e per il work stealing.
+ * @return 0 successo, altrimenti il codice d'errore.
+ *
+ * NOTA: il contatore submitting permette a threadpool_destroy di attendere
+ *       le aggiunte già in corso quando imposta shutdown: così nessun task
+ *       viene inserito dopo che i worker hanno visto la coda vuota e sono usciti.
+ *       Chi attende spazio sulla futex space rientra nel conteggio: destroy
+ *       lo sveglia e l'aggiunta termina con ECANCELED.
+ */
+static int threadpool_add_lf(threadpool_t* pool, void (*function) (void*), void* argument, long timeout_ms) {
+
+    threadpool_task_t task = { function, argument };
+    struct timespec ts; uint64_t deadline = 0, now; int err, epoch;
+
+    if (timeout_ms > 0)
+        deadline = monotonic_ns() + (uint64_t)timeout_ms * NSEC_PER_MSEC;
+
+    __atomic_add_fetch(&pool->submitting, 1, __ATOMIC_SEQ_CST);
+
+    while ((err = lf_submit(pool, &task)) == EAGAIN && timeout_ms != 0) {
+
+        if (timeout_ms > 0) {
+
+            if ((now = monotonic_ns()) >= deadline) {
+                err = ETIMEDOUT; break; }
+
+            ts.tv_sec = (deadline - now) / NSEC_PER_SEC; ts.tv_nsec = (deadline - now) % NSEC_PER_SEC;
+        }
+
+        // Come per i worker inattivi: leggo il contatore prima di ritentare,
+        // così una cella liberata dopo il tentativo non va persa.
+        __atomic_add_fetch(&pool->blocked, 1, __ATOMIC_SEQ_CST);
+        epoch = __atomic_load_n(&pool->space, __ATOMIC_SEQ_CST);
+
+        if ((err = lf_submit(pool, &task)) == EAGAIN)
+            futex_wait(&pool->space, epoch, (timeout_ms > 0) ? &ts : NULL);
+
+        __atomic_sub_fetch(&pool->blocked, 1, __ATOMIC_SEQ_CST);
+
+        if (err != EAGAIN)
+            break;
+    }
+
+    __atomic_sub_fetch(&pool->submitting, 1, __ATOMIC_SEQ_CST);
+
+    return err;
+}
+
+/**
+ * @function threadpool_add_mutex
+ * @brief threadpool_add_timed per la coda con mutex.
+ * @return 0 successo, altrimenti il codice d'errore.
+ */
+static int threadpool_add_mutex(threadpool_t* pool, void (*function) (void*), void* argument, long timeout_ms) {
+
+    struct timespec deadline; int err = 0;
+
+    if (timeout_ms > 0) {
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000; deadline.tv_nsec += (timeout_ms % 1000) * NSEC_PER_MSEC;
+        if (deadline.tv_nsec >= NSEC_PER_SEC) { deadline.tv_sec++; deadline.tv_nsec -= NSEC_PER_SEC; }
+    }
+
+    THREAD_ERR (
+        pthread_mutex_lock(&(pool->lock)), 
+        "threadpool_add: pthread_mutex_lock", 
+        return errno
+    )
+
+    // Attendo che si liberi spazio, a meno di un timeout nullo.
+    while (!pool->shutdown && pool->count == pool->queue_size && timeout_ms != 0 && err != ETIMEDOUT) {
+
+        pool->blocked++;
+
+        err = (timeout_ms < 0) ? pthread_cond_wait(&(pool->not_full), &(pool->lock)) :
+                                 pthread_cond_timedwait(&(pool->not_full), &(pool->lock), &deadline);
+        pool->blocked--;
+    }
+
+    if (pool->shutdown)
+        err = ECANCELED;
+
+    else if (pool->count == pool->queue_size)
+        err = (timeout_ms == 0) ? EAGAIN : ETIMEDOUT;
+
+    else {
+
+        pool->queue[pool->tail].function = function;
+        pool->queue[pool->tail].argument = argument;
+        pool->queue[pool->tail].enqueued = (pool->elastic || pool->stats) ? monotonic_ns() : 0;
+        pool->tail = (pool->tail + 1) % pool->queue_size;
+        pool->count += 1;
+
+        if (pool->stats)
+            __atomic_add_fetch(&pool->submitted, 1, __ATOMIC_RELAXED);
+
+        if (pool->count > pool->peak)
+            __atomic_store_n(&pool->peak, pool->count, __ATOMIC_RELAXED);
+
+        err = pthread_cond_signal(&(pool->notify));
+
+        if (pool->elastic && threadpool_starving(pool, pool->count, 0))
+            threadpool_spawn(pool);
+    }
+
+    pthread_mutex_unlock(&(pool->lock));
+
+    return err;
+}
+
+int threadpool_add_timed(threadpool_t* pool, void (*function) (void*), void* argument, long timeout_ms) {
+
+    int err;
+
+    if (!pool || !function) {
+        errno = EINVAL; return -1; }
+
+    err = (pool->kind == threadpool_queue_mutex) ?
+        threadpool_add_mutex(pool, function, argument, timeout_ms) :
+        threadpool_add_lf(pool, function, argument, timeout_ms);
+
+    if (err == 0)
+        return 0;
+
+    __atomic_add_fetch(&pool->rejected, 1, __ATOMIC_RELAXED);
+
+    if (pool->reject)
+        pool->reject(function, argument, err);
+
+    errno = err; return -1;
+}
+
+int threadpool_add_wait(threadpool_t* pool, void (*function) (void*), void* argument) {
+
+    return threadpool_add_timed(pool, function, argument, -1);
+}
+
+int threadpool_try_add(threadpool_t* pool, void (*function) (void*), void* argument) {
+
+    return threadpool_add_timed(pool, function, argument, 0);
+}
+
+int threadpool_add(threadpool_t* pool, void (*function) (void*), void* argument) {
+
+    if (threadpool_add_timed(pool, function, argument, 0) == 0)
+        return 0;
+
+    // Senza funzione di rifiuto il chiamante viene almeno avvisato su stderr.
+    if (pool && !pool->reject)
+        fprintf(stderr, (errno == EAGAIN) ? "threadpool_add: queue full\n" : "threadpool_add: pool shutdown\n");
+
+    return -1;
+}
+
+/**
+ * @function wheel_link
+ * @brief Inserisce il timer @t nel livello della ruota adatto alla distanza
+ *        della sua scadenza: il livello l copre distanze fino a 64^(l+1) tick.
+ *        Oltre l'ultimo livello il timer attende nell'ultimo slot raggiungibile
+ *        e viene ricollocato quando ci arriva.
+ */
+static void wheel_link(threadpool_wheel_t* w, int t) {
+
+    threadpool_timer_t* tm = &w->timers[t];
+    uint64_t expires = tm->expires, delta = expires - w->cur; int level, slot;
+
+    for (level = 0; level < WHEEL_LEVELS - 1 && delta >= (uint64_t)1 << (WHEEL_BITS * (level + 1)); level++);
+
+    if (delta >= (uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS))
+        expires = w->cur + ((uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+    slot = (expires >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+
+    tm->level = level; tm->slot = slot; tm->prev = -1;
+    tm->next = w->wheel[level][slot];
+
+    if (tm->next != -1)
+        w->timers[tm->next].prev = t;
+
+    w->wheel[level][slot] = t;
+    w->bitmap[level] |= (uint64_t)1 << slot;
+}
+
+/**
+ * @function wheel_unlink
+ * @brief Rimuove il timer @t dallo slot in cui si trova.
+ */
+static void wheel_unlink(threadpool_wheel_t* w, int t) {
+
+    threadpool_timer_t* tm = &w->timers[t];
+
+    if (tm->prev != -1) w->timers[tm->prev].next = tm->next;
+    else w->wheel[tm->level][tm->slot] = tm->next;
+
+    if (tm->next != -1)
+        w->timers[tm->next].prev = tm->prev;
+
+    if (w->wheel[tm->level][tm->slot] == -1)
+        w->bitmap[tm->level] &= ~((uint64_t)1 << tm->slot);
+}
+
+/**
+ * @function wheel_release
+ * @brief Restituisce lo slot del timer @t alla lista libera: incrementando
+ *        la generazione, l'identificatore del timer non è più valido.
+ */
+static void wheel_release(threadpool_wheel_t* w, int t) {
+
+    w->timers[t].function = NULL; w->timers[t].gen++;
+    w->timers[t].next = w->free; w->free = t;
+}
+
+/**
+ * @function wheel_detach
+ * @brief Svuota uno slot della ruota.
+ * @return Il primo timer della lista staccata, -1 se lo slot era vuoto.
+ */
+static int wheel_detach(threadpool_wheel_t* w, int level, int slot) {
+
+    int head = w->wheel[level][slot];
+
+    w->wheel[level][slot] = -1;
+    w->bitmap[level] &= ~((uint64_t)1 << slot);
+
+    return head;
+}
+
+/**
+ * @function wheel_tick
+ * @brief Avanza la ruota di un tick: quando un livello completa il giro
+ *        ricolloca nei livelli inferiori lo slot corrente del livello
+ *        superiore, poi raccoglie in ready i timer scaduti, riarmando
+ *        quelli periodici.
+ * @return 0 successo, -1 se non c'è memoria per i task scaduti.
+ */
+static int wheel_tick(threadpool_wheel_t* w) {
+
+    uint64_t t = ++w->cur; int head, next; threadpool_timer_t* tm;
+
+    for (int level = 1; level < WHEEL_LEVELS && (t & (((uint64_t)1 << (WHEEL_BITS * level)) - 1)) == 0; level++)
+        for (head = wheel_detach(w, level, (t >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)); head != -1; head = next) {
+            next = w->timers[head].next; wheel_link(w, head); }
+
+    for (head = wheel_detach(w, 0, t & (WHEEL_SLOTS - 1)); head != -1; head = next) {
+
+        tm = &w->timers[head]; next = tm->next;
+
+        if (tm->expires > t) {
+            wheel_link(w, head); continue; }
+
+        if (w->nready == w->ready_size) {
+
+            w->ready_size = w->ready_size ? 2 * w->ready_size : WHEEL_SLOTS;
+            REALLOC(w->ready, w->ready_size * sizeof(threadpool_task_t), "threadpool: wheel_tick: realloc", return -1)
+        }
+
+        w->ready[w->nready].function = tm->function;
+        w->ready[w->nready].argument = tm->argument;
+        w->nready++;
+
+        // Un timer periodico rimasto indietro salta le esecuzioni perse.
+        if (tm->period) {
+
+            tm->expires += tm->period;
+            if (tm->expires <= t) tm->expires = t + tm->period;
+            wheel_link(w, head);
+        }
+
+        else
+            wheel_release(w, head);
+    }
+
+    return 0;
+}
+
+/**
+ * @function wheel_next
+ * @return Numero di tick prima del prossimo evento della ruota (una scadenza
+ *         nel primo livello o la fine del suo giro, se i livelli superiori
+ *         contengono timer), 0 se la ruota è vuota.
+ */
+static uint64_t wheel_next(threadpool_wheel_t* w) {
+
+    uint64_t wrap = WHEEL_SLOTS - (w->cur & (WHEEL_SLOTS - 1)); boolean upper = false;
+
+    for (int i = 1; i <= WHEEL_SLOTS; i++)
+        if (w->bitmap[0] & ((uint64_t)1 << ((w->cur + i) & (WHEEL_SLOTS - 1))))
+            return (uint64_t)i < wrap ? (uint64_t)i : wrap;
+
+    for (int level = 1; level < WHEEL_LEVELS; level++)
+        upper |= (w->bitmap[level] != 0);
+
+    return upper ? wrap : 0;
+}
+
+/**
+ * @function threadpool_timer_thread
+ * @brief Thread che fa avanzare la ruota dei timer del pool e sottomette
+ *        al pool i task dei timer scaduti. Dorme fino al prossimo evento
+ *        della ruota, o finché non viene aggiunto un timer.
+ */
+static void* threadpool_timer_thread(void* threadpool) {
+
+    threadpool_t* pool = (threadpool_t*)threadpool; threadpool_wheel_t* w = pool->wheel;
+    uint64_t now, next; struct timespec ts; int n;
+
+    pthread_mutex_lock(&(pool->tlock));
+
+    while (!w->stop) {
+
+        now = (monotonic_ns() - w->base) / NSEC_PER_MSEC;
+
+        // Recupero i tick passati saltando quelli senza eventi: a ruota vuota
+        // si arriva subito a now, altrimenti al tick prima del prossimo slot
+        // occupato o della fine del giro del primo livello.
+        while (w->cur < now) {
+
+            if ((next = wheel_next(w)) == 0) {
+                w->cur = now; break; }
+
+            w->cur += (next - 1 < now - w->cur) ? next - 1 : now - w->cur;
+
+            if (w->cur < now && wheel_tick(w) == -1)
+                break;
+        }
+
+        // Sottometto i task scaduti senza il lock dei timer: un task
+        // (o la funzione di rifiuto) può a sua volta programmare timer.
+        if ((n = w->nready) > 0) {
+
+            pthread_mutex_unlock(&(pool->tlock));
+
+            for (int i = 0; i < n; i++)
+                threadpool_try_add(pool, w->ready[i].function, w->ready[i].argument);
+
+            pthread_mutex_lock(&(pool->tlock));
+
+            w->nready = 0; continue;
+        }
+
+        if ((next = wheel_next(w)) == 0)
+            pthread_cond_wait(&(pool->tcond), &(pool->tlock));
+
+        else {
+
+            next = w->base + (w->cur + next) * NSEC_PER_MSEC;
+            ts.tv_sec = next / NSEC_PER_SEC; ts.tv_nsec = next % NSEC_PER_SEC;
+            pthread_cond_timedwait(&(pool->tcond), &(pool->tlock), &ts);
+        }
+    }
+
+    pthread_mutex_unlock(&(pool->tlock)); return NULL;
+}
+
+/**
+ * @function wheel_start
+ * @brief Crea la ruota dei timer e il thread che la fa avanzare.
+ *        Va chiamata con il lock dei timer acquisito.
+ * @return 0 successo, -1 altrimenti.
+ */
+static int wheel_start(threadpool_t* pool) {
+
+    threadpool_wheel_t* w = NULL;
+
+    CALLOC(w, 1, sizeof(threadpool_wheel_t), "threadpool: wheel_start: calloc", return -1)
+
+    for (int level = 0; level < WHEEL_LEVELS; level++)
+        for (int slot = 0; slot < WHEEL_SLOTS; slot++)
+            w->wheel[level][slot] = -1;
+
+    w->free = -1; w->base = monotonic_ns(); pool->wheel = w;
+
+    THREAD_ERR (
+        pthread_create(&(w->thread), NULL, threadpool_timer_thread, (void*)pool),
+        "threadpool: wheel_start: pthread_create",
+        pool->wheel = NULL; free(w); return -1
+    )
+
+    return 0;
+}
+
+/**
+ * @function wheel_stop
+ * @brief Termina il thread dei timer e libera la ruota: i timer pendenti
+ *        vengono scartati e nessun altro timer può essere programmato.
+ */
+static void wheel_stop(threadpool_t* pool) {
+
+    threadpool_wheel_t* w;
+
+    pthread_mutex_lock(&(pool->tlock));
+
+    pool->tclosed = true;
+
+    if ((w = pool->wheel) != NULL) {
+        w->stop = true; pthread_cond_signal(&(pool->tcond)); }
+
+    pthread_mutex_unlock(&(pool->tlock));
+
+    if (w) {
+
+        THREAD_ERR(pthread_join(w->thread, NULL), "threadpool: wheel_stop: pthread_join", )
+
+        if (w->timers) free(w->timers);
+        if (w->ready) free(w->ready);
+
+        free(w); pool->wheel = NULL;
+    }
+}
+
+/**
+ * @function threadpool_schedule
+ * @brief Programma un timer che scade tra @delay_ms millisecondi e,
+ *        se @period_ms è positivo, poi ogni @period_ms millisecondi.
+ * @return L'identificatore del timer, -1 in caso di errore.
+ */
+static long threadpool_schedule(threadpool_t* pool, long delay_ms, long period_ms, void (*function) (void*), void* argument) {
+
+    threadpool_wheel_t* w; threadpool_timer_t* tm; int t, size; uint64_t now;
+
+    if (!pool || !function || delay_ms < 0 || period_ms < 0) {
+        errno = EINVAL; return -1; }
+
+    pthread_mutex_lock(&(pool->tlock));
+
+    if (pool->tclosed) {
+        pthread_mutex_unlock(&(pool->tlock)); errno = ECANCELED; return -1; }
+
+    if (!pool->wheel && wheel_start(pool) == -1) {
+        pthread_mutex_unlock(&(pool->tlock)); return -1; }
+
+    w = pool->wheel;
+
+    // Gli slot dei timer si allocano a blocchi e non vengono mai restituiti.
+    if (w->free == -1) {
+
+        size = w->ntimers ? 2 * w->ntimers : WHEEL_SLOTS;
+
+        if (size > (1 << TIMER_INDEX_BITS)) {
+            pthread_mutex_unlock(&(pool->tlock)); errno = ENOMEM; return -1; }
+
+        REALLOC(w->timers, size * sizeof(threadpool_timer_t), "threadpool_schedule: realloc", pthread_mutex_unlock(&(pool->tlock)); return -1)
+
+        for (t = size - 1; t >= w->ntimers; t--) {
+            w->timers[t].gen = 1; w->timers[t].function = NULL; w->timers[t].next = w->free; w->free = t; }
+
+        w->ntimers = size;
+    }
+
+    t = w->free; tm = &w->timers[t]; w->free = tm->next;
+
+    tm->function = function; tm->argument = argument; tm->period = (uint64_t)period_ms;
+
+    // La scadenza si conta dall'istante corrente, anche se il thread dei timer è indietro.
+    now = (monotonic_ns() - w->base) / NSEC_PER_MSEC;
+    tm->expires = now + (uint64_t)delay_ms;
+    if (tm->expires <= w->cur) tm->expires = w->cur + 1;
+
+    wheel_link(w, t);
+
+    pthread_cond_signal(&(pool->tcond));
+    pthread_mutex_unlock(&(pool->tlock));
+
+    return ((long)(tm->gen & TIMER_GEN_MASK) << TIMER_INDEX_BITS) | t;
+}
+
+long threadpool_schedule_after(threadpool_t* pool, long delay_ms, void (*function) (void*), void* argument) {
+
+    return threadpool_schedule(pool, delay_ms, 0, function, argument);
+}
+
+long threadpool_schedule_every(threadpool_t* pool, long period_ms, void (*function) (void*), void* argument) {
+
+    if (period_ms <= 0) {
+        errno = EINVAL; return -1; }
+
+    return threadpool_schedule(pool, period_ms, period_ms, function, argument);
+}
+
+int threadpool_cancel(threadpool_t* pool, long id) {
+
+    threadpool_wheel_t* w; int t = (int)(id & ((1 << TIMER_INDEX_BITS) - 1)); int res = -1;
+
+    if (!pool || id <= 0) {
+        errno = EINVAL; return -1; }
+
+    pthread_mutex_lock(&(pool->tlock));
+
+    if ((w = pool->wheel) != NULL && t < w->ntimers && w->timers[t].function &&
+            (long)(w->timers[t].gen & TIMER_GEN_MASK) == (id >> TIMER_INDEX_BITS)) {
+
+        wheel_unlink(w, t); wheel_release(w, t); res = 0;
+    }
+
+    pthread_mutex_unlock(&(pool->tlock));
+
+    if (res == -1)
+        errno = ENOENT;
+
+    return res;
+}
+
+int threadpool_destroy(threadpool_t* pool, int flags) {
+
+    int blocked;
+
+    if (!pool) return -1;
+
+    // I timer non ancora scaduti vengono scartati.
+    wheel_stop(pool);
+
+    THREAD_ERR (
+        pthread_mutex_lock(&(pool->lock)),
+        "threadpool_destroy: pthread_mutex_lock",
+        return -1
+    )
+        
+    if (pool->shutdown) {
+        fprintf(stderr, "threadpool_destroy: pool already shutdown\n");
+        return -1;
+    }
+
+    __atomic_store_n(&pool->shutdown, (flags & threadpool_graceful) ?
+        graceful_shutdown : immediate_shutdown, __ATOMIC_SEQ_CST);
+
+    // Con la coda lockfree attendo le aggiunte in corso, poi sveglio tutti i worker.
+    if (pool->kind != threadpool_queue_mutex) {
+
+        __atomic_add_fetch(&pool->space, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&pool->space, INT_MAX);
+
+        while (__atomic_load_n(&pool->submitting, __ATOMIC_SEQ_CST) > 0)
+            sched_yield();
+
+        lf_wake(pool, INT_MAX);
+    }
+
+    THREAD_ERR (
+        pthread_cond_broadcast(&(pool->notify)),
+        "threadpool_destroy: broadcast",
+        return -1;
+    )
+
+    THREAD_ERR (
+        pthread_cond_broadcast(&(pool->not_full)),
+        "threadpool_destroy: broadcast",
+        return -1;
+    )
+
+    THREAD_ERR (
+        pthread_mutex_unlock(&(pool->lock)),
+        "threadpool_destroy: pthread_mutex_unlock",
+        return -1;
+    )
+        
+    // Raccolgo anche i worker che si sono ritirati senza essere sostituiti.
+    for (int i = 0; i < pool->max_threads; i++) {
+        if (pool->workers[i].state != worker_free)
+            THREAD_ERR (
+                pthread_join(pool->threads[i], NULL),
+                "threadpool_destroy: pthread_join",
+            ) }
+
+    // Attendo che chi era in attesa di spazio nella coda con mutex abbia rilasciato il lock.
+    while (true) {
+
+        pthread_mutex_lock(&(pool->lock));
+        blocked = pool->blocked;
+        pthread_mutex_unlock(&(pool->lock));
+
+        if (blocked == 0) break;
+        sched_yield();
+    }
+
+    threadpool_free(pool); return 0;
+}
+
+int threadpool_stats(threadpool_t* pool, threadpool_stats_t* stats) {
+
+    threadpool_worker_t* w; int n;
+
+    if (!pool || !stats)
+        return -1;
+
+    memset(stats, 0, sizeof(threadpool_stats_t));
+
+    stats->threads = __atomic_load_n(&pool->thread_count, __ATOMIC_RELAXED);
+    stats->idle = __atomic_load_n(&pool->idle, __ATOMIC_RELAXED);
+    stats->submitted = __atomic_load_n(&pool->submitted, __ATOMIC_RELAXED);
+    stats->rejected = __atomic_load_n(&pool->rejected, __ATOMIC_RELAXED);
+    stats->peak_queued = __atomic_load_n(&pool->peak, __ATOMIC_RELAXED);
+
+    if (pool->kind == threadpool_queue_mutex)
+        stats->queued = __atomic_load_n(&pool->count, __ATOMIC_RELAXED);
+
+    else
+        stats->queued = lf_depth(pool);
+
+    // Gli slot oltre nworkers non hanno mai ospitato un worker.
+    n = load_acquire(&pool->nworkers);
+
+    for (int i = 0; i < n; i++) {
+
+        w = &pool->workers[i];
+        stats->completed += __atomic_load_n(&w->completed, __ATOMIC_RELAXED);
+
+        if (pool->kind == threadpool_queue_stealing)
+            stats->queued += __atomic_load_n(&w->deque.bottom, __ATOMIC_RELAXED) - __atomic_load_n(&w->deque.top, __ATOMIC_RELAXED);
+
+        for (int b = 0; b < THREADPOOL_HIST_BUCKETS; b++) {
+
+            stats->wait_hist[b] += __atomic_load_n(&w->wait_hist[b], __ATOMIC_RELAXED);
+            stats->run_hist[b] += __atomic_load_n(&w->run_hist[b], __ATOMIC_RELAXED);
+        }
+    }
+
+    if (stats->queued < 0)
+        stats->queued = 0;
+
+    return 0;
+}
+
+uint64_t threadpool_hist_percentile(const unsigned long* hist, double q) {
+
+    unsigned long total = 0, seen = 0; int b;
+
+    for (b = 0; b < THREADPOOL_HIST_BUCKETS; b++)
+        total += hist[b];
+
+    if (total == 0)
+        return 0;
+
+    for (b = 0; b < THREADPOOL_HIST_BUCKETS - 1; b++)
+        if ((seen += hist[b]) >= q * total)
+            break;
+
+    return (uint64_t)1 << (b + 1);
 }
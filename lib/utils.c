@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 199309L
+
 /**
  * @file utils.c
  * @brief Implementazione delle funzioni definite nella
@@ -10,6 +12,9 @@
  */
 
 #include <utils.h>
+#include <time.h>
+
+int __err__;
 
 long stol(const char* str, int base) {
 
@@ -32,6 +37,30 @@ long stol(const char* str, int base) {
     return val;
 }
 
+long envtol(const char* name, long def) {
+
+    char *str = getenv(name), *endptr; long val;
+
+    if (!str || *str == '\0')
+        return def;
+
+    errno = 0; val = strtol(str, &endptr, 10);
+
+    if (errno != 0 || *endptr != '\0') {
+
+        fprintf(stderr, "envtol: valore non valido per %s: %s\n", name, str);
+        return def;
+    }
+
+    return val;
+}
+
+uint64_t monotonic_ns() {
+
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
 int mywrite(int fd, const char* buf) { return write(fd, buf, strlen(buf)); }
 
 int myread(int fd, char* buf, const int size) { int __n__ = read(fd, buf, size); buf[__n__] = '\0'; return __n__; }
@@ -0,0 +1,228 @@
+#define _POSIX_C_SOURCE 200809L
+
+/**
+ * @file aggregator.c
+ * @brief Aggregatore radice: riceve dai supervisor (avviati con
+ *        OOB_SUPERVISOR_ROOT) le differenze delle loro tabelle e le fonde,
+ *        con minimo e somma, in un'unica tabella. Ogni supervisor gestisce
+ *        solo il proprio intervallo di server, l'aggregatore ha la visione
+ *        complessiva. La tabella si stampa come quella del supervisor:
+ *        con un SIGINT su stderr, con due SIGINT entro un secondo (o SIGTERM)
+ *        su stdout, prima di terminare.
+ *
+ * @author Alessio Bardelli 544270
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore
+ */
+
+#include <connection.h>
+#include <utils.h>
+#include <dict.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+
+#define MAX_LEAVES 64 // Supervisor connessi contemporaneamente.
+#define MAX_EVENTS 64 // Eventi restituiti al più da una epoll_wait.
+#define READ_SIZE (4096 * DELTA_SIZE) // Byte letti al più da un supervisor ad ogni risveglio.
+#define ESTIMATE_LINE 80 // Spazio sufficiente per una riga della tabella.
+
+#define EV_SIGNAL UINT32_MAX // Dati dell'evento del signalfd, nella epoll...
+#define EV_LISTEN (UINT32_MAX - 1) // ...e del socket in ascolto; i supervisor hanno il loro indice.
+
+/**
+ * @struct Leaf_t
+ * @brief Supervisor connesso, con l'eventuale record incompleto
+ *        rimasto in coda all'ultima lettura.
+ */
+typedef struct {
+
+    int fd;                     /**< -1 se libero. */
+    char partial[DELTA_SIZE];
+    int npartial;
+    unsigned long deltas;       /**< Record ricevuti. */
+
+} Leaf_t;
+
+static Dict_t* dict;
+static Leaf_t leaves[MAX_LEAVES];
+
+static int stop = false;
+static time_t lasttime = 0;
+
+/**
+ * @function print_table
+ * @brief Stampa su @file la tabella delle stime, nello stesso formato
+ *        del supervisor, con una sola write.
+ */
+static void print_table(FILE* file) {
+
+    long long int key; struct value_t value; char* buffer = NULL; size_t len = 0;
+
+    fflush(file);
+
+    CALLOC(buffer, (size_t)dict->len * ESTIMATE_LINE + 1, sizeof(char), "aggregator: print_table: calloc", return)
+
+    foreach(dict, key, value)
+        len += sprintf(buffer + len, "SUPERVISOR ESTIMATE %d FOR %x BASED ON %d\n", value.miglior_stima, (int)key, value.count_server);
+
+    for (size_t off = 0; off < len; ) {
+
+        ssize_t w = write(fileno(file), buffer + off, len - off);
+
+        if (w == -1 && errno == EINTR) continue;
+        if (w == -1) { perror("aggregator: print_table: write"); break; }
+
+        off += w;
+    }
+
+    free(buffer);
+}
+
+/**
+ * @function on_signal
+ * @brief Gestione dei segnali, letti dal signalfd: SIGTERM, o due SIGINT
+ *        entro un secondo, terminano l'aggregatore, un SIGINT stampa la tabella.
+ */
+static void on_signal(int sfd) {
+
+    struct signalfd_siginfo info;
+
+    while (read(sfd, &info, sizeof(info)) == sizeof(info)) {
+
+        if (info.ssi_signo == SIGTERM || time(NULL) - lasttime <= 1)
+            stop = true;
+
+        else
+            print_table(stderr);
+
+        lasttime = time(NULL);
+    }
+}
+
+/**
+ * @function leaf_accept
+ * @brief Accetta i supervisor in attesa di connessione, registrandoli nella epoll @efd.
+ */
+static void leaf_accept(int lfd, int efd) {
+
+    struct epoll_event ev; int fd, i;
+
+    while ((fd = accept(lfd, NULL, NULL)) != -1) {
+
+        for (i = 0; i < MAX_LEAVES && leaves[i].fd != -1; i++);
+
+        if (i == MAX_LEAVES) {
+            fprintf(stderr, "aggregator: leaf_accept: troppi supervisor\n"); close(fd); continue; }
+
+        ev.events = EPOLLIN; ev.data.u32 = i;
+        MENO1(epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev), "aggregator: leaf_accept: epoll_ctl", close(fd); continue)
+
+        leaves[i].fd = fd; leaves[i].npartial = 0; leaves[i].deltas = 0;
+        printf("AGGREGATOR LEAF %d CONNECTED\n", i); fflush(stdout);
+    }
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        perror("aggregator: leaf_accept: accept");
+}
+
+/**
+ * @function leaf_receive
+ * @brief Legge i record del supervisor @i e li fonde nella tabella. Un record
+ *        incompleto attende la lettura successiva; alla chiusura viene scartato.
+ */
+static void leaf_receive(int i) {
+
+    static char buffer[DELTA_SIZE + READ_SIZE];
+    Leaf_t* leaf = &leaves[i]; int64_t id; int32_t stima, count; int len = leaf->npartial, n, off;
+
+    memcpy(buffer, leaf->partial, len);
+
+    while ((n = read(leaf->fd, buffer + len, READ_SIZE)) == -1 && errno == EINTR);
+
+    if (n <= 0) {
+
+        if (n == -1) perror("aggregator: leaf_receive: read");
+
+        printf("AGGREGATOR LEAF %d DISCONNECTED AFTER %lu DELTAS\n", i, leaf->deltas); fflush(stdout);
+        close(leaf->fd); leaf->fd = -1;
+        return;
+    }
+
+    for (len += n, off = 0; off + DELTA_SIZE <= len; off += DELTA_SIZE, leaf->deltas++) {
+
+        delta_decode(buffer + off, &id, &stima, &count);
+        merge(dict, id, stima, count);
+    }
+
+    leaf->npartial = len - off; memcpy(leaf->partial, buffer + off, leaf->npartial);
+}
+
+int main(int argc, char** argv) {
+
+    int efd, sfd, lfd, n; struct epoll_event ev, events[MAX_EVENTS]; sigset_t mask;
+    const char* path; Address_t addr;
+
+    // Socket in ascolto: argomento, OOB_AGGREGATOR_SOCKET, o OOB-aggregator.
+    if ((path = argc > 1 ? argv[1] : getenv("OOB_AGGREGATOR_SOCKET")) == NULL || !*path)
+        path = AGGREGATOR_SOCKET;
+
+    for (int i = 0; i < MAX_LEAVES; i++)
+        leaves[i].fd = -1;
+
+    NULL_ERR(dict = initDict(), "aggregator: main: initDict", exit(EXIT_FAILURE))
+
+    sigemptyset(&mask); sigaddset(&mask, SIGINT); sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    MENO1(efd = epoll_create1(EPOLL_CLOEXEC), "aggregator: main: epoll_create1", exit(EXIT_FAILURE))
+    MENO1(sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC), "aggregator: main: signalfd", exit(EXIT_FAILURE))
+
+    ev.events = EPOLLIN; ev.data.u32 = EV_SIGNAL;
+    MENO1(epoll_ctl(efd, EPOLL_CTL_ADD, sfd, &ev), "aggregator: main: epoll_ctl", exit(EXIT_FAILURE))
+
+    memset(&addr, 0, sizeof(addr)); ADDRESS_INIT(addr, path);
+
+    MENO1(lfd = socket(AF_UNIX, SOCK_STREAM, 0), "aggregator: main: socket", exit(EXIT_FAILURE))
+    MENO1(fcntl(lfd, F_SETFL, O_NONBLOCK), "aggregator: main: fcntl", exit(EXIT_FAILURE))
+
+    unlink(path); // Elimino il socket rimasto da esecuzioni precedenti.
+
+    MENO1(bind(lfd, (struct sockaddr*)&addr, sizeof(addr)), "aggregator: main: bind", exit(EXIT_FAILURE))
+    MENO1(listen(lfd, MAX_LEAVES), "aggregator: main: listen", exit(EXIT_FAILURE))
+
+    ev.events = EPOLLIN; ev.data.u32 = EV_LISTEN;
+    MENO1(epoll_ctl(efd, EPOLL_CTL_ADD, lfd, &ev), "aggregator: main: epoll_ctl", exit(EXIT_FAILURE))
+
+    printf("AGGREGATOR STARTING %s\n", path); fflush(stdout);
+
+    while (!stop) {
+
+        if ((n = epoll_wait(efd, events, MAX_EVENTS, -1)) == -1) {
+
+            if (errno == EINTR) continue;
+            perror("aggregator: main: epoll_wait"); break;
+        }
+
+        for (int e = 0; e < n; e++) {
+
+            if (events[e].data.u32 == EV_SIGNAL) on_signal(sfd);
+            else if (events[e].data.u32 == EV_LISTEN) leaf_accept(lfd, efd);
+            else if (leaves[events[e].data.u32].fd != -1) leaf_receive((int)events[e].data.u32);
+        }
+    }
+
+    print_table(stdout);
+    printf("AGGREGATOR EXITING\n");
+
+    for (int i = 0; i < MAX_LEAVES; i++)
+        if (leaves[i].fd != -1) close(leaves[i].fd);
+
+    close(lfd); unlink(path); close(sfd); close(efd);
+    deleteDict(dict);
+
+    return 0;
+}
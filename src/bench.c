@@ -0,0 +1,135 @@
+#define _GNU_SOURCE
+
+/**
+ * @file bench.c
+ * @brief Generatore di carico per misurare il throughput di un server:
+ *        avvia un server, vi apre C connessioni e invia M messaggi su
+ *        ciascuna il più velocemente possibile, misurando il tempo
+ *        necessario perché il server le chiuda tutte.
+ *        Il motore di I/O del server si sceglie con le stesse variabili
+ *        d'ambiente del server (OOB_SERVER_ENGINE, OOB_SERVER_LOOPS).
+ *
+ * @author Alessio Bardelli 544270
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore
+ */
+
+#include <connection.h>
+#include <threadpool.h>
+#include <utils.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#define BENCH_SERVER_ID 999 // Identificatore del server avviato dal benchmark.
+
+static int C, M; // Numero di connessioni e di messaggi per connessione.
+
+// Sincronizzazione con il thread che legge lo stdout del server.
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int active = false, closed = 0;
+
+/**
+ * @function reader
+ * @brief Legge lo stdout del server contando le connessioni chiuse.
+ *        Deve girare in un thread a parte, altrimenti il server
+ *        si bloccherebbe sulla printf con la pipe piena.
+ */
+static void* reader(void* arg) {
+
+    FILE* out = (FILE*)arg; char line[256];
+
+    while (fgets(line, sizeof(line), out) != NULL) {
+
+        pthread_mutex_lock(&lock);
+
+        if (strstr(line, " ACTIVE"))
+            active = true;
+
+        else if (strstr(line, " CLOSING "))
+            closed++;
+
+        pthread_cond_signal(&cond);
+        pthread_mutex_unlock(&lock);
+    }
+
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+
+    int out[2], pfd, *sockets = NULL; pid_t pid; pthread_t tid; Frame_t frame;
+    char sockname[UNIX_PATH_MAX], arg1[16], arg2[16], msg[FRAME_SIZE]; uint64_t start, end; double elapsed;
+
+    if (argc < 3 || (C = (int)stol(argv[1], 10)) <= 0 || (M = (int)stol(argv[2], 10)) <= 0) {
+
+        fprintf(stderr, "Usage: %s <connessioni> <messaggi-per-connessione>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    CALLOC(sockets, C, sizeof(int), "bench: main: calloc", exit(EXIT_FAILURE))
+
+    // Avvio il server, con lo stdout rediretto verso di me. Le stime non
+    // interessano: vanno su /dev/null, così il canale non si riempie mai.
+    MENO1(pipe(out), "bench: main: pipe", exit(EXIT_FAILURE))
+    MENO1(pfd = open("/dev/null", O_WRONLY), "bench: main: open", exit(EXIT_FAILURE))
+    MENO1(pid = fork(), "bench: main: fork", exit(EXIT_FAILURE))
+
+    if (!pid) {
+
+        snprintf(arg1, 16, "%d", BENCH_SERVER_ID); snprintf(arg2, 16, "%d", pfd);
+        dup2(out[1], STDOUT_FILENO); close(out[0]); close(out[1]);
+
+        execl("bin/server", "server", arg1, arg2, NULL);
+
+        perror("bench: main: execl"); exit(EXIT_FAILURE);
+    }
+
+    close(out[1]); close(pfd);
+    THREAD_ERR(pthread_create(&tid, NULL, reader, fdopen(out[0], "r")), "bench: main: pthread_create", exit(EXIT_FAILURE))
+
+    pthread_mutex_lock(&lock);
+    while (!active) pthread_cond_wait(&cond, &lock);
+    pthread_mutex_unlock(&lock);
+
+    // Apro tutte le connessioni.
+    snprintf(sockname, UNIX_PATH_MAX, "OOB-server-%d", BENCH_SERVER_ID);
+    Address_t addr; ADDRESS_INIT(addr, sockname);
+
+    for (int i = 0; i < C; i++) {
+
+        MENO1(sockets[i] = socket(AF_UNIX, SOCK_STREAM, 0), "bench: main: socket", exit(EXIT_FAILURE))
+        MENO1(connect(sockets[i], (struct sockaddr*)&addr, sizeof(addr)), "bench: main: connect", exit(EXIT_FAILURE))
+    }
+
+    start = monotonic_ns();
+
+    // Invio i messaggi a rotazione su tutte le connessioni, poi le chiudo.
+    frame.flags = 0; frame.send_ts = 0;
+
+    for (int j = 0; j < M; j++)
+        for (int i = 0; i < C; i++) {
+
+            frame.id = i + 1; frame.seq = j; frame_encode(msg, &frame);
+            MENO1(write(sockets[i], msg, FRAME_SIZE), "bench: main: write", exit(EXIT_FAILURE))
+        }
+
+    for (int i = 0; i < C; i++)
+        close(sockets[i]);
+
+    // Attendo che il server abbia chiuso tutte le connessioni.
+    pthread_mutex_lock(&lock);
+    while (closed < C) pthread_cond_wait(&cond, &lock);
+    pthread_mutex_unlock(&lock);
+
+    end = monotonic_ns(); elapsed = (double)(end - start) / NSEC_PER_SEC;
+
+    kill(pid, SIGTERM); waitpid(pid, NULL, 0);
+    pthread_join(tid, NULL); free(sockets);
+
+    printf("connessioni=%d messaggi=%d tempo=%.3fs throughput=%.0f msg/s\n", C, C*M, elapsed, (C*M) / elapsed);
+
+    return 0;
+}
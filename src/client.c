@@ -10,7 +10,6 @@
  * originale dell'autore
  */
 
-#include <arpa/inet.h>
 #include <connection.h>
 #include <utils.h>
 #include <time.h>
@@ -22,29 +21,36 @@ static int *indexs, *sockets, *choices;
 
 static struct timespec timeout;
 
-static char msg[16];
+static char msg[FRAME_SIZE];
 
 /**
  * @function Connect
- * @brief Connette il client al server, riprovando per @MAX_RETRY volte si il
- *        tentativo fallisce, ciascuna volta attendendo per @SLEEP_TIME secondi.
+ * @brief Connette il client al server, riprovando se il server non è ancora
+ *        in ascolto: la prima attesa è di @RETRY_MIN_MS millisecondi, poi
+ *        raddoppia fino a @RETRY_MAX_MS, per al più @RETRY_TIMEOUT_MS in tutto.
  * @param skt File descriptor della socket del server.
  * @param addr Indirizzo della socket del server.
  */
 static void Connect(int skt, Address_t* addr) {
 
-    int i = 0, res = -1;
-    while (res == -1 && i < MAX_RETRY) {
+    int i = 0, res = -1; long delay = RETRY_MIN_MS, waited = 0; struct timespec ts;
+    while (res == -1 && waited <= RETRY_TIMEOUT_MS) {
 
         printf("Tentativo di connessione n° %d al server %s.\n", ++i, addr->sun_path);
         res = connect(skt, (struct sockaddr*)addr, sizeof(*addr));
 
-        if (res == -1 && errno == ENOENT) {
+        // Socket non ancora creata, o creata ma non ancora in ascolto.
+        if (res == -1 && (errno == ENOENT || errno == ECONNREFUSED)) {
 
-            printf("Tentativo di connessione non riuscito, nuovo tentativo tra %d secondi.\n", SLEEP_TIME);
-            sleep(SLEEP_TIME);
+            printf("Tentativo di connessione non riuscito, nuovo tentativo tra %ld ms.\n", delay);
 
-        } else if (res == -1 && errno != ENOENT) {
+            ts.tv_sec = delay / 1000; ts.tv_nsec = (delay % 1000) * 1000000;
+            nanosleep(&ts, NULL);
+
+            waited += delay;
+            if ((delay *= 2) > RETRY_MAX_MS) delay = RETRY_MAX_MS;
+
+        } else if (res == -1) {
 
             printf("Connessione al server fallita.\n");
             exit(EXIT_FAILURE);
@@ -60,6 +66,31 @@ static void Connect(int skt, Address_t* addr) {
     exit(EXIT_FAILURE);
 }
 
+/**
+ * @function Send
+ * @brief Invia al server tutti i @len byte del messaggio, riprendendo
+ *        dopo le scritture parziali e le interruzioni da segnale.
+ * @param skt File descriptor della socket del server.
+ * @param buf Messaggio da inviare.
+ * @param len Lunghezza del messaggio.
+ * @return 0 in caso di successo, -1 altrimenti (errno impostato da write).
+ */
+static int Send(int skt, const char* buf, size_t len) {
+
+    ssize_t n;
+    while (len > 0) {
+
+        if ((n = write(skt, buf, len)) == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        buf += n; len -= n;
+    }
+
+    return 0;
+}
+
 /**
  * @functiom mix
  * @brief Funzione utilizzata per inizializzare il generatore pseudo-casuale.
@@ -194,15 +225,24 @@ int main(int argc, char** argv) {
     for (int i = 0; i < W; i++)
         choices[i] = rand() % P;
 
-	// Genero il messaggio che dovrà 
-	// essere inviato ai server.
-    snprintf(msg, 16, "%ud", htonl(ID));
+	// Il frame inviato ai server porta l'id del client e il numero
+	// di sequenza del messaggio; l'istante di invio viene aggiunto
+	// solo se richiesto con la variabile d'ambiente OOB_CLIENT_TIMESTAMP.
+    Frame_t frame;
+    frame.id = ID; frame.send_ts = 0;
+    frame.flags = envtol("OOB_CLIENT_TIMESTAMP", 0) ? FRAME_F_TIMESTAMP : 0;
 
     // Fase di invio dei messaggi ai server
 	//  e attesa tramite nanosleep.
     for (int i = 0; i < W; i++) {
 
-        mywrite(sockets[choices[i]], msg);
+        frame.seq = i;
+
+        if (frame.flags & FRAME_F_TIMESTAMP)
+            frame.send_ts = monotonic_ns();
+
+        frame_encode(msg, &frame);
+        MENO1(Send(sockets[choices[i]], msg, FRAME_SIZE), "client: main: write", exit(EXIT_FAILURE))
         nanosleep(&timeout, NULL);
     }
 
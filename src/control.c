@@ -0,0 +1,62 @@
+#define _POSIX_C_SOURCE 200809L
+
+/**
+ * @file control.c
+ * @brief Interroga il supervisor attraverso il suo socket di controllo
+ *        (OOB_SUPERVISOR_CONTROL, di default OOB-supervisor), stampando
+ *        la risposta fino alla riga "END" compresa:
+ *          control TABLE       tutta la tabella delle stime;
+ *          control GET <id>    la stima del client <id> (in esadecimale);
+ *          control STATS       contatori del supervisor.
+ *
+ * @author Alessio Bardelli 544270
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore
+ */
+
+#include <connection.h>
+#include <utils.h>
+
+int main(int argc, char** argv) {
+
+    char cmd[UNIX_PATH_MAX], line[256]; const char* path; int skt, len = 0, err = false; FILE* in;
+    Address_t addr;
+
+    if (argc < 2) {
+
+        fprintf(stderr, "Usage: %s TABLE | GET <id> | STATS\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 1; i < argc && len < (int)sizeof(cmd); i++)
+        len += snprintf(cmd + len, sizeof(cmd) - len, i + 1 < argc ? "%s " : "%s\n", argv[i]);
+
+    if (len >= (int)sizeof(cmd)) {
+        fprintf(stderr, "control: main: comando troppo lungo\n"); exit(EXIT_FAILURE); }
+
+    if ((path = getenv("OOB_SUPERVISOR_CONTROL")) == NULL || !*path)
+        path = CONTROL_SOCKET;
+
+    memset(&addr, 0, sizeof(addr)); ADDRESS_INIT(addr, path);
+
+    MENO1(skt = socket(AF_UNIX, SOCK_STREAM, 0), "control: main: socket", exit(EXIT_FAILURE))
+    MENO1(connect(skt, (struct sockaddr*)&addr, sizeof(addr)), "control: main: connect", exit(EXIT_FAILURE))
+    MENO1(write(skt, cmd, len), "control: main: write", exit(EXIT_FAILURE))
+
+    NULL_ERR(in = fdopen(skt, "r"), "control: main: fdopen", exit(EXIT_FAILURE))
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+
+        fputs(line, stdout);
+
+        if (strncmp(line, "ERR ", 4) == 0)
+            err = true;
+
+        if (strncmp(line, "END ", 4) == 0)
+            break;
+    }
+
+    fclose(in);
+    return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,124 @@
+#define _POSIX_C_SOURCE 200809L
+
+/**
+ * @file poolbench.c
+ * @brief Microbenchmark del threadpool: P thread produttori sottomettono
+ *        task vuoti ad un pool di T worker, misurando i task eseguiti
+ *        al secondo con le diverse implementazioni della coda.
+ *        Con F > 0 ogni task sottomette a sua volta F sottotask dal
+ *        worker che lo esegue, il caso favorevole al work stealing.
+ *        Con OOB_POOL_STATS=1 il pool raccoglie le statistiche sui tempi,
+ *        stampate al termine.
+ *
+ * @author Alessio Bardelli 544270
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore
+ */
+
+#include <threadpool.h>
+#include <sched.h>
+
+#define QUEUE_SIZE 4096 // Dimensione della coda del pool.
+
+static threadpool_t* tp;
+static int N, F = 0; // Task sottomessi da ogni produttore, sottotask per task.
+static unsigned long submitted = 0, done = 0;
+
+/**
+ * @function task
+ * @brief Task vuoto: si limita a contare la propria esecuzione.
+ */
+static void task(void* arg) { __atomic_add_fetch(&done, 1, __ATOMIC_RELAXED); }
+
+/**
+ * @function parent
+ * @brief Sottomette F sottotask, eseguendo direttamente quelli
+ *        che non trovano posto nella coda.
+ */
+static void parent(void* arg) {
+
+    for (int i = 0; i < F; i++)
+        if (threadpool_add(tp, task, NULL) == -1)
+            task(NULL);
+
+    task(NULL);
+}
+
+/**
+ * @function producer
+ * @brief Sottomette N task, senza mai riempire la coda.
+ */
+static void* producer(void* arg) {
+
+    for (int i = 0; i < N; i++) {
+
+        while (__atomic_load_n(&submitted, __ATOMIC_RELAXED) - __atomic_load_n(&done, __ATOMIC_RELAXED) >= QUEUE_SIZE / 2)
+            sched_yield();
+
+        // Conto subito anche i sottotask, perché nemmeno loro riempiano la coda.
+        __atomic_add_fetch(&submitted, F + 1, __ATOMIC_RELAXED);
+
+        if (threadpool_add(tp, F > 0 ? parent : task, NULL) == -1) {
+            __atomic_sub_fetch(&submitted, F + 1, __ATOMIC_RELAXED); i--; }
+    }
+
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+
+    threadpool_attr_t attr; threadpool_stats_t st; pthread_t* producers = NULL;
+    int T, P; double start, end; unsigned long total;
+
+    if (argc < 5 || (T = (int)stol(argv[2], 10)) <= 0 || (P = (int)stol(argv[3], 10)) <= 0 || (N = (int)stol(argv[4], 10)) <= 0) {
+
+        fprintf(stderr, "Usage: %s <mutex|lockfree|stealing> <worker> <produttori> <task-per-produttore> [sottotask-per-task]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (argc > 5 && (F = (int)stol(argv[5], 10)) < 0)
+        F = 0;
+
+    total = (unsigned long)P * N * (F + 1);
+
+    threadpool_attr_init(&attr, T, QUEUE_SIZE);
+
+    if (strcmp(argv[1], "lockfree") == 0)
+        attr.queue = threadpool_queue_lockfree;
+
+    else if (strcmp(argv[1], "stealing") == 0)
+        attr.queue = threadpool_queue_stealing;
+
+    attr.stats = envtol("OOB_POOL_STATS", 0) != 0;
+
+    NULL_ERR(tp = threadpool_create_attr(&attr), "poolbench: main: threadpool_create_attr", exit(EXIT_FAILURE))
+    CALLOC(producers, P, sizeof(pthread_t), "poolbench: main: calloc", exit(EXIT_FAILURE))
+
+    start = monotonic_ns() / 1e9;
+
+    for (int i = 0; i < P; i++)
+        THREAD_ERR(pthread_create(&producers[i], NULL, producer, NULL), "poolbench: main: pthread_create", exit(EXIT_FAILURE))
+
+    for (int i = 0; i < P; i++)
+        pthread_join(producers[i], NULL);
+
+    while (__atomic_load_n(&done, __ATOMIC_RELAXED) < total)
+        sched_yield();
+
+    end = monotonic_ns() / 1e9;
+
+    threadpool_stats(tp, &st);
+    threadpool_destroy(tp, threadpool_graceful); free(producers);
+
+    printf("coda=%s worker=%d produttori=%d sottotask=%d task=%lu tempo=%.3fs throughput=%.0f task/s\n",
+           argv[1], T, P, F, total, end - start, total / (end - start));
+
+    if (attr.stats)
+        printf("  attesa p50=%luns p99=%luns esecuzione p50=%luns p99=%luns picco coda=%ld rifiutati=%lu\n",
+               (unsigned long)threadpool_hist_percentile(st.wait_hist, 0.5), (unsigned long)threadpool_hist_percentile(st.wait_hist, 0.99),
+               (unsigned long)threadpool_hist_percentile(st.run_hist, 0.5), (unsigned long)threadpool_hist_percentile(st.run_hist, 0.99),
+               st.peak_queued, st.rejected);
+
+    return 0;
+}
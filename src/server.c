@@ -1,45 +1,128 @@
-#define _POSIX_C_SOURCE 199309L
+#define _GNU_SOURCE
 
 /**
  * @file server.c
  * @brief Sorgente principale del server.
  *
  * @author Alessio Bardelli 544270
- * 
+ *
  * Si dichiara che il contenuto di questo file è in ogni sua parte opera
  * originale dell'autore
  */
 
-#include <sys/time.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <connection.h>
 #include <threadpool.h>
-#include <netinet/in.h>
+#include <iouring.h>
+#include <logger.h>
+#include <shmring.h>
+
+#define MAX_EVENTS 256 // Numero massimo di eventi restituiti da una epoll_wait.
+#define EPOLL_TIMEOUT 100 // Timeout, in millisecondi, della epoll_wait.
+#define MAX_LOOPS MAX_THREADS // Numero massimo di event loop per server.
+#define READ_SIZE (128 * FRAME_SIZE) // Byte letti al più da una read (motore epoll).
+
+#define URING_ENTRIES 256 // Dimensione della submission queue di ogni loop io_uring.
+#define URING_BUFS 512 // Numero di buffer forniti al kernel da ogni loop (potenza di due).
+#define URING_BUFSIZE 2048 // Dimensione di ciascun buffer fornito al kernel.
+#define URING_CANCEL 1 // user_data della cancellazione della accept (non è un puntatore valido).
+
+#define FD_RESERVE 16 // File descriptor lasciati liberi oltre a quelli delle connessioni.
+
+/**
+ * @struct Conn_t
+ * @brief Stato associato ad ogni connessione con un client,
+ *        contiene tutto quello che serve per stimare il secret.
+ */
+typedef struct Conn_t {
+
+    int fd;                      /**< File descriptor della connessione con il client. */
+    long long int ID;            /**< Id del client, -1 finché non arriva il primo messaggio. */
+    uint64_t stima_ns;           /**< Miglior stima del secret, in ns, UINT64_MAX se non disponibile. */
+    uint64_t prec_message;       /**< Istante di arrivo (CLOCK_MONOTONIC, ns) del messaggio precedente, 0 se non noto. */
+    uint64_t prec_ts;            /**< Istante di invio del frame precedente, 0 se non noto. */
+
+    char pending[FRAME_SIZE];    /**< Frame parziale, completato dalla read successiva. */
+    int npending;                /**< Numero di byte in @pending. */
+
+    struct Conn_t *prev, *next;  /**< Lista delle connessioni aperte. */
+
+} Conn_t;
+
+/**
+ * @struct Loop_t
+ * @brief Event loop eseguito da un thread del pool: possiede la propria
+ *        istanza epoll e tutte le connessioni che ha accettato, per cui
+ *        lo stato di una connessione non è mai condiviso tra thread.
+ */
+typedef struct {
+
+    int id;         /**< Indice del loop. */
+    int efd;        /**< File descriptor dell'istanza epoll del loop. */
+    Conn_t* conns;  /**< Lista delle connessioni aperte, chiuse alla terminazione. */
+
+    boolean accepting;  /**< false se il loop ha sospeso l'accettazione di nuove connessioni. */
+    uint64_t resume_at; /**< Istante (CLOCK_MONOTONIC, ns) prima del quale non la riprende. */
+
+    char estimates[ESTIMATE_BATCH]; /**< Record delle stime non ancora inviati al supervisor. */
+    int nestimates;                 /**< Byte occupati in estimates. */
 
-#define MAX_CONNECTION 20 // Numero massimo di connessioni.
-#define QUEUE_SIZE 20 // Dimensione della coda del thread pool. 
+#ifdef HAVE_IO_URING
+    Uring_t ring;       /**< Istanza io_uring del loop (solo con il motore io_uring). */
+    UringBufs_t bufs;   /**< Buffer in cui il kernel scrive i messaggi ricevuti. */
+    boolean armed;      /**< true se la accept multishot è attiva. */
+#endif
 
-static threadpool_t* tp = NULL; // Thread pool per gestire le connessioni con i client.
+} Loop_t;
+
+/**
+ * @enum Engine_t
+ * @brief Motore di I/O usato dagli event loop, scelto con
+ *        la variabile d'ambiente OOB_SERVER_ENGINE ("epoll" o "uring").
+ */
+typedef enum {
+
+    engine_epoll = 0,
+    engine_uring = 1
+
+} Engine_t;
+
+static Engine_t engine = engine_epoll;
+
+static threadpool_t* tp = NULL; // Thread pool che esegue gli event loop.
+
+static Loop_t* loops = NULL; // Array degli event loop.
+static int nloops; // Numero di event loop (variabile d'ambiente OOB_SERVER_LOOPS).
+
+// Connessioni aperte da tutti i loop e limite oltre il quale smettono di accettarne
+// (variabile d'ambiente OOB_SERVER_MAX_CONN, di default dal limite sui file descriptor).
+static int nconns = 0, max_conns;
 
 // Variabile utilizzata per interrompere il ciclo del server.
-static volatile sig_atomic_t stop = false; 
+static volatile sig_atomic_t stop = false;
 
-// Id del server, file descriptor della pipe con 
+// Id del server, file descriptor della pipe con
 // il supervisor e file descriptor della socket.
 static int server_id, pfd, fd_skt;
 
+// In alternativa alla pipe, buffer condiviso con il supervisor e relativo eventfd.
+static ShmRing_t* ring = NULL;
+static int ring_efd = -1;
+
 static Address_t addr; // Indirizzo del server.
 
 // Gestione dei segnali:
 //   alla ricezione di SIGTERM si esce dal ciclo del server;
-//   SIGINT viene ignorato.
+//   SIGINT e SIGPIPE vengono ignorati.
 static struct sigaction intHandler, termHandlar;
 
 /**
  * @function sigTermHandler
  * @brief Funzione per la gestione di SIGTERM.
- * 
+ *
  * NOTA: Si noti che tale funzione è signal-safe.
  *       Difatti, tale funzione, si limita ad aggiornare
  *       lo stato interno.
@@ -47,164 +130,714 @@ static struct sigaction intHandler, termHandlar;
 static void sigTermHandler(int signum) { stop = true; }
 
 /**
- * @function timeval_sub
- * @brief Utilizzata per effettuare la differenza tra due oggetti 
- *        di tipo struct timeval.
- * @param result Viene scritto il risultato della differenza tra x e y.
+ * @function loop_flush
+ * @brief Invia al supervisor, con una sola write, i record delle stime
+ *        accumulati dal loop.
+ */
+static void loop_flush(Loop_t* loop) {
+
+    int off = 0, n;
+
+    while (off < loop->nestimates) {
+
+        if ((n = write(pfd, loop->estimates + off, loop->nestimates - off)) == -1) {
+
+            if (errno == EINTR) continue;
+            perror("server: loop_flush: write"); break;
+        }
+
+        off += n;
+    }
+
+    loop->nestimates = 0;
+}
+
+/**
+ * @function conn_close
+ * @brief Chiude la connessione con il client e, se disponibile,
+ *        accoda la stima del secret per il supervisor: i record si
+ *        inviano a blocchi, al termine di ogni giro del loop.
+ */
+static void conn_close(Loop_t* loop, Conn_t* conn) {
+
+    int stima_secret = (conn->stima_ns == UINT64_MAX) ? INT_MAX : (int)(conn->stima_ns / NSEC_PER_MSEC);
+
+    // La close rimuove automaticamente il descrittore dall'istanza epoll.
+    close(conn->fd);
+
+	if (conn->ID != -1 && stima_secret != INT_MAX) {
+
+	    if (ring) {
+
+	        // Se il supervisor non svuota più il buffer la stima va persa, come sulla pipe.
+	        if (shmring_push(ring, ring_efd, conn->ID, stima_secret, RETRY_TIMEOUT_MS) == -1)
+	            perror("server: conn_close: shmring_push");
+	    }
+
+	    else {
+
+	        if (loop->nestimates + ESTIMATE_SIZE > ESTIMATE_BATCH)
+	            loop_flush(loop);
+
+	        estimate_encode(loop->estimates + loop->nestimates, conn->ID, stima_secret);
+	        loop->nestimates += ESTIMATE_SIZE;
+	    }
+	}
+
+    LOG("SERVER %ld CLOSING %lx ESTIMATES %ld\n", server_id, (unsigned int)conn->ID, stima_secret, 0);
+
+    if (conn->prev) conn->prev->next = conn->next; else loop->conns = conn->next;
+    if (conn->next) conn->next->prev = conn->prev;
+
+    __atomic_sub_fetch(&nconns, 1, __ATOMIC_RELAXED);
+
+    free(conn);
+}
+
+/**
+ * @function conn_new
+ * @brief Alloca lo stato di una nuova connessione e lo inserisce
+ *        nella lista delle connessioni del loop.
+ * @return Lo stato della connessione, NULL in caso di errore.
+ */
+static Conn_t* conn_new(Loop_t* loop, int fd_c) {
+
+    Conn_t* conn = NULL;
+
+    CALLOC(conn, 1, sizeof(Conn_t), "server: conn_new: calloc", close(fd_c); return NULL)
+
+    conn->fd = fd_c; conn->ID = -1; conn->stima_ns = UINT64_MAX;
+
+    conn->next = loop->conns; if (loop->conns) loop->conns->prev = conn; loop->conns = conn;
+
+    __atomic_add_fetch(&nconns, 1, __ATOMIC_RELAXED);
+
+    return conn;
+}
+
+/**
+ * @function conn_open
+ * @brief Accetta una nuova connessione, la rende non bloccante e
+ *        la registra nell'istanza epoll insieme al suo stato.
+ * @return 0 successo, -1 altrimenti.
+ */
+static int conn_open(Loop_t* loop, int fd_c) {
+
+    Conn_t* conn; struct epoll_event ev;
+
+    MENO1(fcntl(fd_c, F_SETFL, fcntl(fd_c, F_GETFL) | O_NONBLOCK), "server: conn_open: fcntl", close(fd_c); return -1)
+    NULL_ERR(conn = conn_new(loop, fd_c), "server: conn_open: conn_new", return -1)
+
+    ev.events = EPOLLIN; ev.data.ptr = conn;
+    MENO1(epoll_ctl(loop->efd, EPOLL_CTL_ADD, fd_c, &ev), "server: conn_open: epoll_ctl", conn_close(loop, conn); return -1)
+
+    return 0;
+}
+
+/**
+ * @function conn_frame
+ * @brief Gestisce un frame arrivato dal client all'istante @now (CLOCK_MONOTONIC,
+ *        in ns), aggiornando la stima del secret associata alla connessione.
+ * @param first true se è il primo frame decodificato dalla read corrente.
+ *
+ * NOTA: i frame successivi al primo sono arrivati accorpati nella stessa
+ *       read, per cui il loro istante di arrivo non è significativo:
+ *       ne ricavo un campione soltanto se il client ha indicato
+ *       l'istante di invio, altrimenti lo scarto.
+ */
+static void conn_frame(Conn_t* conn, Frame_t* frame, uint64_t now, boolean first) {
+
+    uint64_t send_ts = (frame->flags & FRAME_F_TIMESTAMP) ? frame->send_ts : 0, sample = UINT64_MAX;
+    struct timespec wall;
+
+    conn->ID = (long long int)frame->id;
+
+    // La riga di log riporta l'ora del giorno, confrontabile con i log di client e
+    // supervisor; il tempo monotono serve solo al calcolo della stima.
+    clock_gettime(CLOCK_REALTIME, &wall);
+
+    logger_write(LOG_STDOUT | LOG_SHEDDABLE, "SERVER %ld INCOMING FROM %lx @ %ld.%03ld\n", server_id,
+                 (unsigned int)conn->ID, (long)wall.tv_sec, wall.tv_nsec / 1000000);
+
+    if (first && conn->prec_message)
+        sample = now - conn->prec_message;
+
+    else if (!first && send_ts && conn->prec_ts && send_ts > conn->prec_ts)
+        sample = send_ts - conn->prec_ts;
+
+    if (conn->stima_ns > sample)
+        conn->stima_ns = sample;
+
+    conn->prec_message = now;
+    conn->prec_ts = send_ts;
+}
+
+/**
+ * @function conn_message
+ * @brief Gestisce i dati @data, lunghi @n byte, arrivati dal client all'istante
+ *        @now, decodificando tutti i frame completi che contengono.
+ *        Un eventuale frame parziale viene conservato nella connessione.
+ */
+static void conn_message(Conn_t* conn, const char* data, int n, uint64_t now) {
+
+    Frame_t frame; boolean first = true; int len;
+
+    // Completo il frame rimasto a metà dalla read precedente.
+    if (conn->npending > 0) {
+
+        len = (n < FRAME_SIZE - conn->npending) ? n : FRAME_SIZE - conn->npending;
+        memcpy(conn->pending + conn->npending, data, len);
+        conn->npending += len; data += len; n -= len;
+
+        if (conn->npending < FRAME_SIZE)
+            return;
+
+        frame_decode(conn->pending, &frame);
+        conn_frame(conn, &frame, now, first);
+        conn->npending = 0; first = false;
+    }
+
+    for (; n >= FRAME_SIZE; data += FRAME_SIZE, n -= FRAME_SIZE, first = false) {
+
+        frame_decode(data, &frame);
+        conn_frame(conn, &frame, now, first);
+    }
+
+    memcpy(conn->pending, data, n); conn->npending = n;
+}
+
+/**
+ * @function conn_read
+ * @brief Legge i messaggi in arrivo dal client (motore epoll).
+ * @param now Istante in cui il loop ha preso in carico l'evento della connessione.
+ * @return 0 se la connessione resta aperta, 1 se il client
+ *         l'ha chiusa (o si è verificato un errore).
+ */
+static int conn_read(Conn_t* conn, uint64_t now) {
+
+    char msg[READ_SIZE]; int n;
+
+    if ((n = read(conn->fd, msg, READ_SIZE)) == -1)
+        return (errno == EAGAIN || errno == EINTR) ? 0 : 1;
+
+    if (n == 0)
+        return 1;
+
+    conn_message(conn, msg, n, now);
+
+    return 0;
+}
+
+/**
+ * @function accept_exhausted
+ * @return true se l'errore della accept indica che mancano le risorse
+ *         per una nuova connessione, per cui conviene smettere di accettarne.
+ */
+static boolean accept_exhausted(int err) {
+
+    return err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM;
+}
+
+/**
+ * @function loop_pause
+ * @brief Il loop smette di accettare nuove connessioni: quelle in arrivo
+ *        restano nella coda della listen (lunga OOB_SERVER_BACKLOG) e i
+ *        client attendono nella connect, invece di essere accettati e poi
+ *        persi. Il loop riprende dopo almeno EPOLL_TIMEOUT millisecondi,
+ *        se il numero di connessioni è sceso sotto il limite.
+ *
+ * NOTA: con la epoll la socket del server viene rimossa dall'istanza del
+ *       loop; con io_uring è il chiamante a cancellare la accept multishot.
+ */
+static void loop_pause(Loop_t* loop, uint64_t now) {
+
+    loop->accepting = false; loop->resume_at = now + EPOLL_TIMEOUT * NSEC_PER_MSEC;
+
+    if (engine == engine_epoll)
+        MENO1(epoll_ctl(loop->efd, EPOLL_CTL_DEL, fd_skt, NULL), "server: loop_pause: epoll_ctl", )
+
+    logger_write(LOG_STDERR, "SERVER %ld LOOP %ld ACCEPT PAUSED WITH %ld CONNECTIONS\n",
+                 server_id, loop->id, __atomic_load_n(&nconns, __ATOMIC_RELAXED), 0);
+}
+
+/**
+ * @function loop_resumable
+ * @return true se il loop, sospeso da loop_pause, può tornare ad accettare connessioni.
+ */
+static boolean loop_resumable(Loop_t* loop, uint64_t now) {
+
+    return !loop->accepting && now >= loop->resume_at && __atomic_load_n(&nconns, __ATOMIC_RELAXED) < max_conns;
+}
+
+/**
+ * @function loop_listen
+ * @brief Con il motore epoll registra la socket del server nell'istanza epoll del loop,
+ *        riconoscibile dal puntatore nullo associato all'evento. EPOLLEXCLUSIVE
+ *        fa sì che una nuova connessione svegli un solo loop alla volta.
+ * @return 0 successo, -1 altrimenti.
+ */
+static int loop_listen(Loop_t* loop) {
+
+    struct epoll_event ev;
+
+    if (engine == engine_epoll) {
+
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE; ev.data.ptr = NULL;
+        MENO1(epoll_ctl(loop->efd, EPOLL_CTL_ADD, fd_skt, &ev), "server: loop_listen: epoll_ctl", return -1)
+    }
+
+    loop->accepting = true; return 0;
+}
+
+/**
+ * @function loop_accept
+ * @brief Accetta tutte le connessioni pendenti sulla socket del server,
+ *        fino al limite sul numero di connessioni.
+ *        Più loop possono essere svegliati dalla stessa connessione:
+ *        chi arriva tardi trova la coda vuota (EAGAIN) e torna ad attendere.
  */
-static int timeval_sub(struct timeval* result, struct timeval* x, struct timeval* y) {
+static void loop_accept(Loop_t* loop, uint64_t now) {
+
+    int fd_c;
+
+    while (loop->accepting) {
+
+        if (__atomic_load_n(&nconns, __ATOMIC_RELAXED) >= max_conns) {
+            loop_pause(loop, now); break; }
 
-    /* Perform the carry for the later subtraction by updating y. */
-    if (x->tv_usec < y->tv_usec) {
-    
-        int nsec = (y->tv_usec - x->tv_usec) / 1000000 + 1;
-        y->tv_usec -= 1000000 * nsec;
-        y->tv_sec += nsec;
+        if ((fd_c = accept(fd_skt, NULL, 0)) == -1) {
+
+            if (accept_exhausted(errno))
+                loop_pause(loop, now);
+
+            else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                perror("server: loop_accept: accept");
+
+            break;
+        }
+
+        LOG("SERVER %ld CONNECT FROM CLIENT\n", server_id, 0, 0, 0);
+        conn_open(loop, fd_c);
     }
+}
 
-    if (x->tv_usec - y->tv_usec > 1000000) {
-    
-        int nsec = (y->tv_usec - x->tv_usec) / 1000000;
-        y->tv_usec += 1000000 * nsec;
-        y->tv_sec -= nsec;
+/**
+ * @function loop_run_epoll
+ * @brief Event loop basato su epoll, eseguito fino alla ricezione di SIGTERM.
+ */
+static void loop_run_epoll(Loop_t* loop) {
+
+    struct epoll_event events[MAX_EVENTS]; int n; uint64_t now;
+
+    // Fin tanto che non ricevo SIGTERM...
+    while (!stop) {
+
+        // Attendo che almeno uno dei canali sia pronto per operazioni di I/O.
+        // Se vengo interrotto da un segnale ricontrollo la condizione del ciclo.
+        if ((n = epoll_wait(loop->efd, events, MAX_EVENTS, EPOLL_TIMEOUT)) == -1) {
+
+            if (errno == EINTR) continue;
+            perror("server: loop_run_epoll: epoll_wait"); break;
+        }
+
+        now = monotonic_ns();
+
+        if (loop_resumable(loop, now))
+            loop_listen(loop);
+
+        for (int i = 0; i < n; i++) {
+
+            // Se la socket del server è pronta per operazioni di I/O...
+            if (events[i].data.ptr == NULL)
+                loop_accept(loop, monotonic_ns());
+
+            // Altrimenti è arrivato un messaggio da un client (o la chiusura della connessione):
+            // l'istante di arrivo si prende per ogni evento, così il tempo speso sugli eventi
+            // precedenti dello stesso blocco non si somma alla stima.
+            else if (conn_read(events[i].data.ptr, monotonic_ns()))
+                conn_close(loop, events[i].data.ptr);
+        }
+
+        loop_flush(loop);
     }
+}
+
+#ifdef HAVE_IO_URING
 
-    /* Compute the time remaining to wait.
-       tv_usec is certainly positive. */
-    result->tv_sec = x->tv_sec - y->tv_sec;
-    result->tv_usec = x->tv_usec - y->tv_usec;
+/**
+ * @function uring_sqe
+ * @brief Restituisce una sqe libera del loop, pubblicando
+ *        quelle pendenti se la submission queue è piena.
+ */
+static struct io_uring_sqe* uring_sqe(Loop_t* loop) {
+
+    struct io_uring_sqe* sqe;
+
+    while ((sqe = uring_get_sqe(&loop->ring)) == NULL)
+        uring_submit_and_wait(&loop->ring, 0, 0);
+
+    return sqe;
+}
+
+/**
+ * @function uring_arm_accept
+ * @brief Prepara una accept multishot sulla socket del server: ogni nuova
+ *        connessione produce un completamento con il suo file descriptor.
+ *        Come per la epoll, la socket del server ha user_data nullo.
+ */
+static void uring_arm_accept(Loop_t* loop) {
+
+    struct io_uring_sqe* sqe = uring_sqe(loop);
+
+    sqe->opcode = IORING_OP_ACCEPT; sqe->fd = fd_skt;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT; sqe->user_data = 0;
+
+    loop->armed = true;
+}
+
+/**
+ * @function uring_cancel_accept
+ * @brief Cancella la accept multishot, che termina con un
+ *        completamento senza IORING_CQE_F_MORE.
+ */
+static void uring_cancel_accept(Loop_t* loop) {
+
+    struct io_uring_sqe* sqe = uring_sqe(loop);
 
-    /* Return 1 if result is negative. */
-    return x->tv_sec < y->tv_sec;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL; sqe->fd = -1;
+    sqe->addr = 0; sqe->user_data = URING_CANCEL;
 }
 
 /**
- * @function task
- * @brief Task che viene eseguito da un thread del pool,
- *        gestisce tutta la connessione con il client e 
- *        stima il secret in base ai messaggi che il client gli invia.
- *        Quando il client termina la connessione procede con l'invio
- *        della sua stima del secret al supervisor.
- * @param arg Array di 3 interi:
- *        arg[0] -> file descriptor della connessione con il client;
- *        arg[1] -> file descriptor della pipe con il supervisor;
- *        arg[2] -> identificatore del server.
+ * @function uring_arm_recv
+ * @brief Prepara una recv multishot sulla connessione: il kernel sceglie
+ *        un buffer del gruppo del loop per ogni messaggio ricevuto.
  */
-static void task(void* arg) {
+static void uring_arm_recv(Loop_t* loop, Conn_t* conn) {
+
+    struct io_uring_sqe* sqe = uring_sqe(loop);
+
+    sqe->opcode = IORING_OP_RECV; sqe->fd = conn->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT; sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = loop->bufs.bgid; sqe->user_data = (uintptr_t)conn;
+}
+
+/**
+ * @function loop_run_uring
+ * @brief Event loop basato su io_uring, eseguito fino alla ricezione di SIGTERM.
+ *        Accept e recv sono multishot, per cui in regime non serve alcuna
+ *        system call per messaggio: una sola io_uring_enter raccoglie
+ *        tutti i completamenti disponibili.
+ */
+static void loop_run_uring(Loop_t* loop) {
+
+    struct io_uring_cqe* cqe; Conn_t* conn; int res; unsigned flags; uint64_t now;
+
+    loop->accepting = true; uring_arm_accept(loop);
+
+    // Fin tanto che non ricevo SIGTERM...
+    while (!stop) {
+
+        MENO1 (
+            uring_submit_and_wait(&loop->ring, 1, EPOLL_TIMEOUT),
+            "server: loop_run_uring: io_uring_enter",
+            break
+        )
+
+        now = monotonic_ns();
+
+        if (loop_resumable(loop, now)) {
+
+            loop->accepting = true;
+            if (!loop->armed) uring_arm_accept(loop);
+        }
 
-    char msg[64]; struct timeval lst_message, prec_message, estimate;
-    prec_message.tv_usec = INT_MAX; prec_message.tv_sec = LONG_MAX;
-    int stima_secret = INT_MAX;
+        while ((cqe = uring_peek_cqe(&loop->ring)) != NULL) {
 
-    int fd_c = ((int*)arg)[0];
-    int pfd = ((int*)arg)[1];
-    int server_id = ((int*)arg)[2];
+            // Copio il completamento: dopo uring_cqe_seen il kernel può riusare la cqe.
+            conn = (Conn_t*)(uintptr_t)cqe->user_data; res = cqe->res; flags = cqe->flags;
+            uring_cqe_seen(&loop->ring);
 
-	long long int ID = -1;
+            if ((uintptr_t)conn == URING_CANCEL)
+                continue;
 
-	while (myread(fd_c, msg, 64) != 0) {
+            // Completamento della accept multishot...
+            if (conn == NULL) {
 
-        gettimeofday(&lst_message, NULL);
+                if (res >= 0) {
 
-        ID = ntohl(atol(msg)); memset(msg, '\0', 64);
+                    LOG("SERVER %ld CONNECT FROM CLIENT\n", server_id, 0, 0, 0);
+                    if ((conn = conn_new(loop, res)) != NULL) uring_arm_recv(loop, conn);
+                }
 
-        printf("SERVER %d INCOMING FROM %x @ %ld.%d\n", server_id, (int)ID, lst_message.tv_sec, (int)lst_message.tv_usec/1000);
-        fflush(stdout);
+                else if (res != -EAGAIN && res != -EINTR && res != -ECANCELED && !accept_exhausted(-res)) {
+                    errno = -res; perror("server: loop_run_uring: accept"); }
 
-        timeval_sub(&estimate, &lst_message, &prec_message);
+                // Raggiunto il limite (o esaurite le risorse) smetto di accettare.
+                if (loop->accepting && (accept_exhausted(-res) || __atomic_load_n(&nconns, __ATOMIC_RELAXED) >= max_conns)) {
 
-        char est[32]; long min_est;
+                    loop_pause(loop, now);
+                    if (flags & IORING_CQE_F_MORE) uring_cancel_accept(loop);
+                }
 
-        snprintf(est, 32, "%ld%03d", labs(estimate.tv_sec), abs(estimate.tv_usec/1000));
+                if (!(flags & IORING_CQE_F_MORE)) {
 
-		if ((min_est = strtoll(est, NULL, 10)) == 0) {
-            fprintf(stderr, "server: task: strtol"); exit(EXIT_FAILURE); }
+                    loop->armed = false;
+                    if (loop->accepting) uring_arm_accept(loop);
+                }
 
-        if (stima_secret > min_est)
-            stima_secret = min_est;
-        
-        prec_message = lst_message;
+                continue;
+            }
+
+            // ...altrimenti di una recv: consumo i dati e restituisco il buffer al kernel.
+            if (flags & IORING_CQE_F_BUFFER) {
+
+                unsigned short bid = flags >> IORING_CQE_BUFFER_SHIFT;
+
+                if (res > 0)
+                    conn_message(conn, uring_bufs_get(&loop->bufs, bid), res, monotonic_ns());
+
+                uring_bufs_recycle(&loop->bufs, bid);
+            }
+
+            // Il client ha chiuso la connessione (o si è verificato un errore)...
+            if (res == 0 || (res < 0 && res != -ENOBUFS))
+                conn_close(loop, conn);
+
+            // ...altrimenti, se la recv multishot è terminata, la riarmo.
+            else if (!(flags & IORING_CQE_F_MORE))
+                uring_arm_recv(loop, conn);
+        }
+
+        loop_flush(loop);
     }
+}
 
-    close(fd_c); memset(msg, '\0', 64);
+#endif // HAVE_IO_URING
 
-	if (ID != -1 && stima_secret != INT_MAX) {
-	    snprintf(msg, 64, "%lld,%d", ID, stima_secret); mywrite(pfd, msg); }
-    
-    printf("SERVER %d CLOSING %x ESTIMATES %d\n", server_id, (int)ID, stima_secret);
-    fflush(stdout);
+/**
+ * @function loop_run
+ * @brief Task eseguito da un thread del pool: esegue un event loop
+ *        con il motore di I/O scelto fino alla ricezione di SIGTERM.
+ * @param arg Puntatore al Loop_t da eseguire.
+ */
+static void loop_run(void* arg) {
+
+    Loop_t* loop = (Loop_t*)arg;
+
+#ifdef HAVE_IO_URING
+    if (engine == engine_uring)
+        loop_run_uring(loop);
+    else
+#endif
+    loop_run_epoll(loop);
+
+    // Chiudo le connessioni rimaste aperte.
+    while (loop->conns) conn_close(loop, loop->conns);
+
+    loop_flush(loop);
 }
 
+#ifdef HAVE_IO_URING
+
+/**
+ * @function loop_init_uring
+ * @brief Crea l'istanza io_uring e il gruppo di buffer del loop.
+ * @return 0 successo, -1 altrimenti.
+ */
+static int loop_init_uring(Loop_t* loop) {
+
+    if (uring_init(&loop->ring, URING_ENTRIES) == -1)
+        return -1;
+
+    if (uring_bufs_init(&loop->ring, &loop->bufs, 0, URING_BUFS, URING_BUFSIZE) == -1) {
+        uring_exit(&loop->ring); return -1; }
+
+    return 0;
+}
+
+/**
+ * @function loop_exit_uring
+ * @brief Distrugge l'istanza io_uring e il gruppo di buffer del loop.
+ */
+static void loop_exit_uring(Loop_t* loop) {
+
+    uring_bufs_exit(&loop->ring, &loop->bufs);
+    uring_exit(&loop->ring);
+}
+
+#endif // HAVE_IO_URING
+
 int main(int argc, char** argv) {
 
-    char sockname[UNIX_PATH_MAX]; int fd_c;
-    fd_set set, rdset; FD_ZERO(&set); FD_ZERO(&rdset);
+    char sockname[UNIX_PATH_MAX]; sigset_t mask, oldmask; char* str;
+    struct rlimit rl; int i = 0, backlog, cpus[THREADPOOL_MAX_CPUS]; threadpool_attr_t attr;
 
     // Parso dagli argomenti del main l'identificatore del server,
-    // e il file descriptor della pipe con il supervisor.
+    // e il file descriptor della pipe con il supervisor, oppure
+    // (con pipe -1) quelli del buffer condiviso e del suo eventfd.
     server_id = stol(argv[1], 10);
     pfd = stol(argv[2], 10);
-    
+
+    if (argc > 4) {
+
+        int memfd = (int)stol(argv[3], 10);
+
+        ring_efd = (int)stol(argv[4], 10);
+        NULL_ERR(ring = shmring_attach(memfd), "server: main: shmring_attach", exit(EXIT_FAILURE))
+        close(memfd);
+    }
+
+    // Numero di event loop, di default uno per CPU su cui il server può girare
+    // (il supervisor assegna ad ogni server un insieme di CPU disgiunto).
+    if ((nloops = (int)envtol("OOB_SERVER_LOOPS", 0)) < 1)
+        nloops = threadpool_cpus(threadpool_affinity_none, cpus, THREADPOOL_MAX_CPUS);
+    if (nloops < 1 || nloops > MAX_LOOPS) nloops = 1;
+
+    // Motore di I/O, di default epoll.
+    if ((str = getenv("OOB_SERVER_ENGINE")) != NULL && strcmp(str, "uring") == 0) {
+#ifdef HAVE_IO_URING
+        engine = engine_uring;
+#else
+        fprintf(stderr, "server: main: supporto a io_uring non compilato, uso epoll\n");
+#endif
+    }
+
+    // Lunghezza della coda delle connessioni in attesa di essere accettate:
+    // quando i loop sospendono l'accettazione è qui che attendono i client.
+    backlog = (int)envtol("OOB_SERVER_BACKLOG", SOMAXCONN);
+    if (backlog < 1) backlog = SOMAXCONN;
+
+    // Limite sulle connessioni aperte, di default quante ne permette il limite sui file descriptor.
+    max_conns = (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < INT_MAX) ?
+                (int)rl.rlim_cur - FD_RESERVE - 2 * nloops : INT_MAX;
+    max_conns = (int)envtol("OOB_SERVER_MAX_CONN", max_conns);
+    if (max_conns < 1) max_conns = 1;
+
     // Istallazione dei gestori dei segnali.
     memset(&intHandler, 0, sizeof(intHandler));
     memset(&termHandlar, 0, sizeof(termHandlar));
     intHandler.sa_handler = SIG_IGN;
     termHandlar.sa_handler = sigTermHandler;
     sigaction(SIGINT, &intHandler, NULL);
+    sigaction(SIGPIPE, &intHandler, NULL);
     sigaction(SIGTERM, &termHandlar, NULL);
 
-    unlink(sockname); // Elimino eventuali socket rimaste da esecuzioni precedenti.
+    // Blocco SIGTERM prima di creare i thread, in modo che sia 
+    // consegnato soltanto al thread main, nella sigsuspend.
+    sigemptyset(&mask); sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, &oldmask);
+
+    // Avvio il logger asincrono: i loop non scrivono più direttamente su stdout.
+    MENO1(logger_init(), "server: main: logger_init", exit(EXIT_FAILURE))
 
     // Creo la socket del server e inizializzo l'indirizzo del server.
     snprintf(sockname, UNIX_PATH_MAX, "OOB-server-%d", server_id); ADDRESS_INIT(addr, sockname);
     MENO1(fd_skt = socket(AF_UNIX, SOCK_STREAM, 0), "server: main: socket", exit(EXIT_FAILURE))
 
+    unlink(sockname); // Elimino eventuali socket rimaste da esecuzioni precedenti.
+
     // Faccio il bind tra la socket e l'indirizzo del server e mi preparo per accettare connessioni.
     MENO1(bind(fd_skt, (struct sockaddr*) &addr, sizeof(addr)), "server: main: bind", exit(EXIT_FAILURE))
-    MENO1(listen(fd_skt, MAX_CONNECTION), "server: main: listen", exit(EXIT_FAILURE)) FD_SET(fd_skt, &set);
+    MENO1(listen(fd_skt, backlog), "server: main: listen", exit(EXIT_FAILURE))
+
+    // Creo un'istanza epoll per ogni loop.
+    CALLOC(loops, nloops, sizeof(Loop_t), "server: main: calloc", goto err)
+
+    for (i = 0; i < nloops; i++) {
+
+        loops[i].id = i; loops[i].conns = NULL; loops[i].nestimates = 0;
+        MENO1(loops[i].efd = epoll_create1(0), "server: main: epoll_create1", goto err)
+    }
+
+#ifdef HAVE_IO_URING
+    // Con il motore io_uring ogni loop ha anche la propria istanza io_uring;
+    // se il kernel non la supporta si ripiega sulla epoll.
+    if (engine == engine_uring) {
+
+        int j;
+
+        for (j = 0; j < nloops; j++)
+            if (loop_init_uring(&loops[j]) == -1)
+                break;
+
+        if (j < nloops) {
+
+            fprintf(stderr, "server: main: io_uring non disponibile, uso epoll\n");
+            while (j-- > 0) loop_exit_uring(&loops[j]);
+            engine = engine_epoll;
+        }
+    }
+#endif
+
+    // La epoll richiede una socket del server non bloccante, in modo che più
+    // loop possano svuotare la coda delle connessioni senza bloccarsi.
+    if (engine == engine_epoll)
+        MENO1(fcntl(fd_skt, F_SETFL, fcntl(fd_skt, F_GETFL) | O_NONBLOCK), "server: main: fcntl", goto err)
+
+    // Solo ora che il motore è deciso registro la socket del server nei loop:
+    // con io_uring le connessioni arrivano dalla accept multishot, non dalla epoll.
+    for (int j = 0; j < nloops; j++)
+        MENO1(loop_listen(&loops[j]), "server: main: loop_listen", goto err)
+
+    // Inizializzazione del thread pool, un thread per ogni loop:
+    // con più loop ciascuno resta su una CPU, vicina a quelle degli altri.
+    threadpool_attr_init(&attr, nloops, nloops);
+    if (nloops > 1) attr.affinity = threadpool_affinity_compact;
 
-    // Inizializzazione del thread pool. 
 	NULL_ERR (
-        tp = threadpool_create(MAX_CONNECTION, QUEUE_SIZE), 
-        "server: main: threadpool_create", 
-        close(fd_skt); exit(EXIT_FAILURE)
+        tp = threadpool_create_attr(&attr),
+        "server: main: threadpool_create_attr",
+        goto err
     )
 
-    // Stampa del messaggio di avvio.
-	printf("SERVER %d ACTIVE\n", server_id); fflush(stdout);
+    // Segnalo al supervisor che accetto connessioni, con il primo record del canale.
+    if (ring) {
+        MENO1(shmring_push(ring, ring_efd, ESTIMATE_READY, server_id, RETRY_TIMEOUT_MS), "server: main: shmring_push", ) }
 
-    // Fin tanto che non ricevo SIGTERM...
-    while (!stop) {
+    else if (pfd >= 0) {
+
+        char ready[ESTIMATE_SIZE]; estimate_encode(ready, ESTIMATE_READY, server_id);
+        MENO1(write(pfd, ready, ESTIMATE_SIZE), "server: main: write", )
+    }
 
-        rdset = set; struct timeval timeout = {0, 150};
+    // Stampa del messaggio di avvio.
+    LOG("SERVER %ld ACTIVE\n", server_id, 0, 0, 0);
 
-        // Seleziono i canali che sono pronti per operazioni di I/O. 
-        // Se vengo interrotto durante la SC la riattivo esplicitamente. 
-        while (select(fd_skt+1, &rdset, NULL, NULL, &timeout) == -1 && errno == EINTR);
+    // La coda ha posto per tutti i loop; se comunque un loop non parte termino.
+    for (i = 0; i < nloops && !stop; i++)
+        if (threadpool_add_wait(tp, &loop_run, (void*)&loops[i]) == -1) {
+            perror("server: main: threadpool_add_wait"); stop = true; }
 
-        // Se la socket del server è pronta per operazioni di I/O...
-        if (FD_ISSET(fd_skt, &rdset)) {
+    // Fin tanto che non ricevo SIGTERM resto in attesa.
+    while (!stop)
+        sigsuspend(&oldmask);
 
-            // Accetto la nuova conessione da parte del client.
-            MENO1(fd_c = accept(fd_skt, NULL, 0), "server: main: accept", goto err)
-            printf("SERVER %d CONNECT FROM CLIENT\n", server_id); fflush(stdout);
+    // Attendo la terminazione dei loop, libero la memoria e chiudo i descrittori di file.
+    threadpool_destroy(tp, threadpool_graceful);
 
-            // Metto in coda un nuovo task.
-            int arg[] = {fd_c, pfd, server_id};
-		    threadpool_add(tp, &task, (void*)arg);
-        }
+    for (i = 0; i < nloops; i++) {
+
+#ifdef HAVE_IO_URING
+        if (engine == engine_uring)
+            loop_exit_uring(&loops[i]);
+#endif
+        close(loops[i].efd);
     }
 
-    // Libero la memoria e chiudo i descrittori di file.
-	threadpool_destroy(tp, threadpool_graceful);
-	close(fd_skt); unlink(sockname); close(pfd);
+    free(loops); close(fd_skt); unlink(sockname); close(pfd);
+    shmring_detach(ring); if (ring_efd != -1) close(ring_efd);
+    logger_exit();
 
 	return 0;
 
     err: {
 
-        threadpool_destroy(tp, threadpool_immediate);
+        while (i-- > 0)
+            close(loops[i].efd);
+
+        if (loops) free(loops);
 	    close(fd_skt); unlink(sockname); close(pfd);
-        exit(EXIT_FAILURE);
+        logger_exit(); exit(EXIT_FAILURE);
     }
 }
@@ -1,8 +1,15 @@
-#define _POSIX_C_SOURCE 199309L
+#define _POSIX_C_SOURCE 200809L
 
 /**
  * @file supervisor.c
- * @brief Sorgente principale del supervisor.
+ * @brief Sorgente principale del supervisor. Le stime dei server attraversano
+ *        una pipeline: i thread di I/O (un pool) si ripartiscono i canali dei
+ *        server e ne decodificano i record a blocchi, i worker di aggregazione
+ *        (un secondo pool) li riportano nella tabella condivisa. Il thread
+ *        principale gestisce soltanto i segnali, la stampa della tabella e
+ *        le richieste ricevute dal socket di controllo.
+ *        Più supervisor, ciascuno con un intervallo di server, possono
+ *        inviare le proprie stime ad un aggregatore radice (bin/aggregator).
  *
  * @author Alessio Bardelli 544270
  * 
@@ -11,150 +18,1248 @@
  */
 
 #include <utils.h>
+#include <connection.h>
 #include <dict.h>
+#include <logger.h>
+#include <threadpool.h>
+#include <shmring.h>
 #include <signal.h>
+#include <stdarg.h>
+#include <spawn.h>
+#include <fcntl.h>
 #include <time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
 
-static Dict_t* dict;
+#define MAX_EVENTS 64 // Eventi restituiti al più da una epoll_wait.
+#define READ_SIZE (16 * ESTIMATE_BATCH) // Byte letti al più da una pipe ad ogni risveglio.
+#define BATCH_RECORDS 1024 // Stime consegnate al più con un task di aggregazione (buffer condivisi).
+#define AGG_QUEUE 1024 // Blocchi di stime in attesa dei worker di aggregazione.
+#define CAP_SWEEP_MS 100 // Periodo del controllo del limite sulla tabella, senza TTL.
+#define REAP_SLICE_MS 100 // Attesa massima di SIGCHLD prima di ricontrollare i server.
+#define STATS_PERIOD_MS 1000 // Intervallo su cui si misurano le stime al secondo.
+#define CONTROL_MAX_CONN 16 // Connessioni contemporanee al socket di controllo.
+#define CONTROL_LINE 128 // Lunghezza massima di un comando di controllo.
+#define PATH_SIZE 64 // Spazio per i percorsi di default dei file del supervisor.
 
-static volatile sig_atomic_t stop = false;
-static volatile sig_atomic_t print_request = false;
+#define EV_SIGNAL UINT32_MAX // Dati dell'evento del signalfd, nella epoll del thread principale...
+#define EV_CONTROL (UINT32_MAX - 1) // ...e del socket di controllo; le connessioni hanno il loro indice.
 
-static int k;
-static int* pids;
+extern char** environ;
+
+/**
+ * @struct Batch_t
+ * @brief Blocco di stime ricevute da un server, aggregato da un unico task.
+ */
+typedef struct {
+
+    int server;
+    int n;
+
+    struct {
+        int64_t id;
+        int32_t stima;
+    } rec[];
+
+} Batch_t;
+
+/**
+ * @struct Control_t
+ * @brief Connessione al socket di controllo: comandi ricevuti in attesa
+ *        di una riga completa e risposta in attesa di essere scritta.
+ */
+typedef struct {
+
+    int fd;                     /**< -1 se la connessione è libera. */
+    char in[CONTROL_LINE];
+    int nin;
+    char* out;
+    size_t nout, off, size;
+
+} Control_t;
+
+static CDict_t* dict;
+
+static threadpool_t* io = NULL;     // Thread di I/O, ciascuno con un sottoinsieme dei server.
+static threadpool_t* agg = NULL;    // Worker di aggregazione.
+static int nio, nagg;
+static int stopfd = -1;             // eventfd che termina i thread di I/O.
+
+static int stop = false;
+static int print_request = false;
+
+static int k, base;             // Numero di server e identificatore del primo.
+static pid_t* pids;
 static int** pfds;
 
+// Con OOB_SUPERVISOR_SHM=1 le stime arrivano da un buffer condiviso per server,
+// notificato da un eventfd (pfds[i][0]), invece che da una pipe.
+static ShmRing_t** rings = NULL;
+
+// Record incompleti rimasti in coda all'ultima lettura della pipe di ogni server.
+static char (*partial)[ESTIMATE_SIZE] = NULL;
+static int* npartial = NULL;
+
+static int cpus[THREADPOOL_MAX_CPUS]; // CPU da ripartire tra i server.
+static int ncpus = 0;
+
+// Limiti della tabella: età massima (ms) e numero massimo di entry, 0 per nessun limite.
+static long ttl_ms = 0;
+static int cap = 0;
+static FILE* archive_file = NULL;
+
+// Snapshot della tabella, scritto ogni snapshot_ms millisecondi (0 solo all'uscita).
+static const char* snapshot = NULL;
+static long snapshot_ms = 0;
+
+// Con SIGINT si stampano solo le stime cambiate dalla stampa precedente.
+static int print_dirty = false;
+
+// Socket di controllo (OOB_SUPERVISOR_CONTROL) e sue connessioni.
+static const char* control_path = NULL;
+static int control_fd = -1;
+static Control_t control[CONTROL_MAX_CONN];
+
+// Stime aggregate per server e, ogni STATS_PERIOD_MS, stime al secondo.
+static unsigned long* received = NULL;
+static unsigned long* rate = NULL;
+static unsigned long* lastcount = NULL;
+static uint64_t started, lastsample;
+
+// Con OOB_SUPERVISOR_ROOT le stime ricevute dall'ultimo invio si accumulano
+// anche in pending, inviata all'aggregatore ogni forward_ms millisecondi.
+static const char* root_path = NULL;
+static int root_fd = -1, root_warned = false;
+static CDict_t* pending = NULL;
+static pthread_mutex_t forward_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static time_t lasttime = 0;
-static struct sigaction intHandler;
-static void sigIntHandler(int signum) {
 
-    if (time(NULL) - lasttime <= 1)
-        stop = true;
+/**
+ * @function on_sigint
+ * @brief Gestione di SIGINT, letto dal signalfd: due SIGINT entro un
+ *        secondo terminano il supervisor, uno solo richiede la tabella.
+ */
+static void on_sigint(int sfd) {
+
+    struct signalfd_siginfo info;
+
+    while (read(sfd, &info, sizeof(info)) == sizeof(info)) {
+
+        if (time(NULL) - lasttime <= 1)
+            stop = true;
+
+        else
+            print_request = true;
+
+        lasttime = time(NULL);
+    }
+}
+
+/**
+ * @function aggregate
+ * @brief Task di aggregazione: riporta nella tabella le stime del blocco.
+ *        Stime dello stesso client possono essere aggregate da worker
+ *        diversi, in qualunque ordine: minimo e conteggio non ne dipendono.
+ */
+static void aggregate(void* arg) {
+
+    Batch_t* batch = (Batch_t*)arg;
+
+    for (int j = 0; j < batch->n; j++) {
+
+        LOG("SUPERVISOR ESTIMATE %ld FOR %lx FROM %ld\n", batch->rec[j].stima, (unsigned int)batch->rec[j].id, base + batch->server, 0);
+        cdict_update(dict, batch->rec[j].id, batch->rec[j].stima);
+
+        if (pending) cdict_update(pending, batch->rec[j].id, batch->rec[j].stima);
+    }
+
+    __atomic_add_fetch(&received[batch->server], batch->n, __ATOMIC_RELAXED);
+    free(batch);
+}
+
+/**
+ * @function batch_new
+ * @return Un blocco vuoto per al più @n stime del server @i, NULL in caso di errore.
+ */
+static Batch_t* batch_new(int i, int n) {
+
+    Batch_t* batch = malloc(sizeof(Batch_t) + (size_t)n * sizeof(batch->rec[0]));
+
+    if (!batch) {
+        perror("supervisor: batch_new: malloc"); return NULL; }
+
+    batch->server = i; batch->n = 0;
+    return batch;
+}
+
+/**
+ * @function batch_submit
+ * @brief Consegna il blocco ai worker di aggregazione, attendendo se sono
+ *        tutti indietro: la pressione risale così fino ai server.
+ */
+static void batch_submit(Batch_t* batch) {
+
+    if (batch->n == 0 || threadpool_add_wait(agg, aggregate, batch) == -1) {
+
+        if (batch->n > 0) perror("supervisor: batch_submit: threadpool_add_wait");
+        free(batch);
+    }
+}
+
+/**
+ * @function drain
+ * @brief Consuma tutte le stime presenti nel buffer condiviso del server @i,
+ *        fino a poter tornare ad attendere sul suo eventfd.
+ */
+static void drain(int i) {
+
+    long long int ID; int stima_secret; uint64_t count; Batch_t* batch = NULL;
+
+    // L'eventfd va azzerato prima di svuotare il buffer, non dopo:
+    // una notifica successiva riguarda stime non ancora lette.
+    if (read(pfds[i][0], &count, sizeof(count)) == -1 && errno != EAGAIN)
+        perror("supervisor: drain: read");
+
+    do {
+
+        while ((batch || (batch = batch_new(i, BATCH_RECORDS)) != NULL) && shmring_pop(rings[i], &ID, &stima_secret)) {
+
+            if (ID == ESTIMATE_READY)
+                continue;
+
+            batch->rec[batch->n].id = ID; batch->rec[batch->n].stima = stima_secret;
+
+            if (++batch->n == BATCH_RECORDS) {
+                batch_submit(batch); batch = NULL; }
+        }
+
+    } while (batch && shmring_wait(rings[i]));
+
+    if (batch) batch_submit(batch);
+}
+
+/**
+ * @function receive
+ * @brief Legge dalla pipe del server @i tutti i byte disponibili (fino a
+ *        READ_SIZE) e aggiorna la tabella con ogni record completo, tenendo
+ *        da parte l'eventuale record spezzato per la lettura successiva.
+ * @return Numero di byte letti, 0 se il server ha chiuso la pipe, -1 in caso di errore.
+ */
+static int receive(int i) {
+
+    char buffer[ESTIMATE_SIZE + READ_SIZE]; Batch_t* batch;
+    int len = npartial[i], n, off;
+
+    memcpy(buffer, partial[i], len);
+
+    while ((n = read(pfds[i][0], buffer + len, READ_SIZE)) == -1 && errno == EINTR);
+
+    if (n <= 0)
+        return n;
+
+    len += n;
+
+    if ((batch = batch_new(i, len / ESTIMATE_SIZE)) == NULL)
+        return -1;
+
+    // Un ESTIMATE_READY arrivato dopo la scadenza dell'attesa non è una stima.
+    for (off = 0; off + ESTIMATE_SIZE <= len; off += ESTIMATE_SIZE) {
+
+        estimate_decode(buffer + off, &batch->rec[batch->n].id, &batch->rec[batch->n].stima);
+        if (batch->rec[batch->n].id != ESTIMATE_READY) batch->n++;
+    }
+
+    npartial[i] = len - off; memcpy(partial[i], buffer + off, npartial[i]);
+
+    batch_submit(batch);
+
+    return n;
+}
+
+/**
+ * @function finish
+ * @brief Raccoglie le ultime stime del server @i, ormai terminato:
+ *        svuota il buffer condiviso, o legge la pipe fino alla fine.
+ */
+static void finish(int i) {
+
+    if (rings) {
+        drain(i); return; }
+
+    // Senza scrittori la read restituisce 0; non bloccante se un server è sopravvissuto.
+    MENO1(fcntl(pfds[i][0], F_SETFL, O_NONBLOCK), "supervisor: finish: fcntl", )
+
+    while (receive(i) > 0);
+}
+
+/**
+ * @function io_loop
+ * @brief Task di un thread di I/O: attende le stime dei server i con
+ *        i % nio == @arg, fino alla scrittura di stopfd, dopo la quale
+ *        raccoglie quanto resta nei canali.
+ */
+static void io_loop(void* arg) {
+
+    int id = (int)(intptr_t)arg, efd, n, len; struct epoll_event ev, events[MAX_EVENTS];
+
+    MENO1(efd = epoll_create1(EPOLL_CLOEXEC), "supervisor: io_loop: epoll_create1", return)
+
+    ev.events = EPOLLIN; ev.data.u32 = UINT32_MAX;
+    MENO1(epoll_ctl(efd, EPOLL_CTL_ADD, stopfd, &ev), "supervisor: io_loop: epoll_ctl", close(efd); return)
+
+    for (int i = id; i < k; i += nio) {
+
+        ev.events = EPOLLIN; ev.data.u32 = i;
+        MENO1(epoll_ctl(efd, EPOLL_CTL_ADD, pfds[i][0], &ev), "supervisor: io_loop: epoll_ctl", )
+    }
+
+    while (true) {
+
+        if ((n = epoll_wait(efd, events, MAX_EVENTS, -1)) == -1) {
+
+            if (errno == EINTR) continue;
+            perror("supervisor: io_loop: epoll_wait"); break;
+        }
+
+        for (int e = 0; e < n; e++) {
+
+            int i = (int)events[e].data.u32;
+
+            // stopfd si scrive quando i server sono terminati.
+            if (events[e].data.u32 == UINT32_MAX) {
+
+                for (int j = id; j < k; j += nio)
+                    finish(j);
+
+                close(efd); return;
+            }
+
+            if (rings) {
+                drain(i); continue; }
+
+            MENO1(len = receive(i), "supervisor: io_loop: read", continue)
+
+            // Server terminato: la sua pipe non verrà più letta.
+            if (len == 0)
+                epoll_ctl(efd, EPOLL_CTL_DEL, pfds[i][0], NULL);
+        }
+    }
+
+    close(efd);
+}
+
+#define ESTIMATE_LINE 80 // Spazio sufficiente per una riga della tabella.
+
+/**
+ * @function format_table
+ * @brief Formatta in un unico buffer le righe della tabella, tutte o (@only_dirty)
+ *        solo quelle modificate dall'ultimo clean. Uno shard alla volta: gli
+ *        altri continuano intanto a ricevere stime. Con @reset gli shard vengono
+ *        poi puliti, e quindi bloccati in scrittura, altrimenti in lettura.
+ * @return Il buffer, da liberare, NULL in caso di errore. In @len la sua
+ *         lunghezza e, se non NULL, in @rows il numero di righe.
+ */
+static char* format_table(CDict_t* cdict, int only_dirty, int reset, size_t* len, int* rows) {
+
+    long long int key; struct value_t value; char* buffer = NULL; size_t size = 1; int n = 0;
+
+    CALLOC(buffer, size, sizeof(char), "supervisor: format_table: calloc", return NULL)
+    *len = 0;
+
+    for (int s = 0; s < cdict->nshards; s++) {
+
+        Dict_t* dict = cdict->shard[s].dict;
+
+        if (reset) pthread_rwlock_wrlock(&cdict->shard[s].lock);
+        else pthread_rwlock_rdlock(&cdict->shard[s].lock);
+
+        size_t need = *len + (size_t)(only_dirty ? dict->ndirty : dict->len) * ESTIMATE_LINE + 1;
+
+        if (need > size) {
+
+            char* tmp = realloc(buffer, size = 2 * need);
+
+            if (!tmp) {
+                pthread_rwlock_unlock(&cdict->shard[s].lock); perror("supervisor: format_table: realloc"); break; }
+
+            buffer = tmp;
+        }
+
+        if (only_dirty)
+            foreach_dirty(dict, key, value) {
+                *len += sprintf(buffer + *len, "SUPERVISOR ESTIMATE %d FOR %x BASED ON %d\n", value.miglior_stima, (int)key, value.count_server); n++; }
+
+        else
+            foreach(dict, key, value) {
+                *len += sprintf(buffer + *len, "SUPERVISOR ESTIMATE %d FOR %x BASED ON %d\n", value.miglior_stima, (int)key, value.count_server); n++; }
+
+        if (reset) clean(dict);
+        pthread_rwlock_unlock(&cdict->shard[s].lock);
+    }
+
+    if (rows) *rows = n;
+    return buffer;
+}
+
+/**
+ * @function print_table
+ * @brief Stampa su @file la tabella delle stime, tutta o (@only_dirty) solo le
+ *        righe modificate dall'ultima stampa. Le righe vengono formattate in
+ *        un unico buffer e scritte con una sola write, così la stampa non
+ *        blocca a lungo la ricezione delle stime.
+ */
+static void print_table(CDict_t* cdict, FILE* file, int only_dirty)  {
+
+    char* buffer; size_t len;
+
+    // I record accodati al logger devono precedere la tabella.
+    logger_flush(); fflush(file);
+
+    NULL_ERR(buffer = format_table(cdict, only_dirty, true, &len, NULL), "supervisor: print_table: format_table", return)
+
+    for (size_t off = 0; off < len; ) {
+
+        ssize_t w = write(fileno(file), buffer + off, len - off);
+
+        if (w == -1 && errno == EINTR) continue;
+        if (w == -1) { perror("supervisor: print_table: write"); break; }
+
+        off += w;
+    }
+
+    free(buffer);
+}
+
+/**
+ * @function archive
+ * @brief Accoda all'archivio la stima finale di un client rimosso dalla tabella.
+ *        L'archivio è una sequenza di record binari di 16 byte, nell'ordine
+ *        dei byte della macchina: id del client (64 bit), stima e numero
+ *        di server che l'hanno ricevuto (32 bit ciascuno).
+ */
+static void archive(const Entry_t* entry, void* arg) {
+
+    struct { int64_t id; int32_t stima; int32_t count; } record;
+
+    record.id = entry->key; record.stima = entry->value.miglior_stima; record.count = entry->value.count_server;
+
+    if (fwrite(&record, sizeof(record), 1, (FILE*)arg) != 1)
+        perror("supervisor: archive: fwrite");
+}
+
+/**
+ * @function spawn
+ * @brief Avvia il server @i con posix_spawn, che gli fa ereditare soltanto i
+ *        descrittori del suo canale (gli altri sono O_CLOEXEC), la maschera
+ *        dei segnali @sigmask e le CPU del thread chiamante.
+ * @return 0 successo, -1 altrimenti.
+ */
+static int spawn(int i, sigset_t* sigmask) {
+
+    char arg1[16], arg2[16], arg3[16], arg4[16]; posix_spawnattr_t attr; int ret = 0;
+    char* args[] = { "server", arg1, arg2, rings ? arg3 : NULL, arg4, NULL };
+
+    snprintf(arg1, 16, "%d", base + i);
+    snprintf(arg2, 16, "%d", rings ? -1 : pfds[i][1]);
+    snprintf(arg3, 16, "%d", pfds[i][1]);
+    snprintf(arg4, 16, "%d", pfds[i][0]);
+
+    // Il server riceve il memfd del buffer (o la pipe) in pfds[i][1] e l'eventfd
+    // in pfds[i][0], che il supervisor tiene per sé con O_CLOEXEC.
+    MENO1(fcntl(pfds[i][1], F_SETFD, 0), "supervisor: spawn: fcntl", return -1)
+    if (rings) MENO1(fcntl(pfds[i][0], F_SETFD, 0), "supervisor: spawn: fcntl", return -1)
+
+    // Con più server che CPU, i server condividono le CPU a rotazione.
+    if (ncpus > 1) {
+
+        int lo = i * ncpus / k, hi = (i + 1) * ncpus / k;
+        if (hi == lo) { lo = i % ncpus; hi = lo + 1; }
+
+        MENO1(threadpool_bind_process(cpus + lo, hi - lo), "supervisor: spawn: threadpool_bind_process", )
+    }
+
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setsigmask(&attr, sigmask);
+
+    THREAD_ERR(posix_spawn(&pids[i], "bin/server", NULL, &attr, args, environ), "supervisor: spawn: posix_spawn", ret = -1)
+
+    posix_spawnattr_destroy(&attr);
+
+    if (rings) MENO1(fcntl(pfds[i][0], F_SETFD, FD_CLOEXEC), "supervisor: spawn: fcntl", ret = -1)
+    close(pfds[i][1]);
+
+    return ret;
+}
+
+/**
+ * @function hello
+ * @brief Legge il primo record dal canale del server @i, che il server
+ *        invia non appena accetta connessioni.
+ * @return 1 se il record è ESTIMATE_READY, 0 se non è ancora arrivato,
+ *         -1 se il server è terminato o ha inviato altro.
+ */
+static int hello(int i) {
+
+    char buffer[ESTIMATE_SIZE]; int64_t ID = 0; int32_t server = -1; long long int id; int stima; uint64_t count = 1;
+
+    if (rings) {
+
+        if (read(pfds[i][0], &count, sizeof(count)) == -1 && errno != EAGAIN)
+            perror("supervisor: hello: read");
+
+        if (!shmring_pop(rings[i], &id, &stima))
+            return 0;
+
+        ID = id; server = stima;
+
+        // Torno ad attendere sull'eventfd: se nel frattempo sono arrivate
+        // stime, lo riscrivo perché le legga il thread di I/O.
+        if (shmring_wait(rings[i]))
+            MENO1(write(pfds[i][0], &count, sizeof(count)), "supervisor: hello: write", )
+    }
+
+    else {
+
+        int n;
+
+        while ((n = read(pfds[i][0], buffer, ESTIMATE_SIZE)) == -1 && errno == EINTR);
+
+        // Una write di ESTIMATE_SIZE byte sulla pipe è atomica.
+        if (n != ESTIMATE_SIZE)
+            return -1;
+
+        estimate_decode(buffer, &ID, &server);
+    }
+
+    return ID == ESTIMATE_READY && server == base + i ? 1 : -1;
+}
+
+/**
+ * @function await_ready
+ * @brief Attende, al più per @ready_ms millisecondi, che tutti i server
+ *        segnalino di accettare connessioni.
+ * @return Numero di server pronti, -1 in caso di errore.
+ */
+static int await_ready(long ready_ms) {
+
+    int efd, n, ready = 0, pending = k; struct epoll_event ev, events[MAX_EVENTS];
+    uint64_t deadline = monotonic_ns() + ready_ms * NSEC_PER_MSEC, now;
+
+    MENO1(efd = epoll_create1(EPOLL_CLOEXEC), "supervisor: await_ready: epoll_create1", return -1)
+
+    for (int i = 0; i < k; i++) {
+
+        ev.events = EPOLLIN; ev.data.u32 = i;
+        MENO1(epoll_ctl(efd, EPOLL_CTL_ADD, pfds[i][0], &ev), "supervisor: await_ready: epoll_ctl", pending--)
+    }
+
+    // I server partono tutti insieme: si attendono in parallelo.
+    while (pending > 0 && (now = monotonic_ns()) < deadline) {
+
+        if ((n = epoll_wait(efd, events, MAX_EVENTS, (int)((deadline - now + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC))) == -1) {
+
+            if (errno == EINTR) continue;
+            perror("supervisor: await_ready: epoll_wait"); break;
+        }
+
+        for (int e = 0; e < n; e++) {
+
+            int i = (int)events[e].data.u32, res = hello(i);
+
+            if (res == 0)
+                continue;
+
+            if (res == 1) ready++;
+            else fprintf(stderr, "supervisor: await_ready: il server %d non è partito\n", base + i);
+
+            epoll_ctl(efd, EPOLL_CTL_DEL, pfds[i][0], NULL); pending--;
+        }
+    }
+
+    if (pending > 0)
+        fprintf(stderr, "supervisor: await_ready: %d server non pronti entro %ld ms\n", pending, ready_ms);
+
+    close(efd);
+    return ready;
+}
+
+/**
+ * @function reap
+ * @brief Attende la terminazione di tutti i server, già raggiunti da SIGTERM,
+ *        con un'unica attesa su SIGCHLD (bloccato): chi non termina entro
+ *        @kill_ms millisecondi riceve SIGKILL.
+ */
+static void reap(long kill_ms) {
+
+    int alive = 0, killed = false; pid_t pid; sigset_t chld; struct timespec ts;
+    uint64_t deadline = monotonic_ns() + kill_ms * NSEC_PER_MSEC, now, wait;
+
+    for (int i = 0; i < k; i++)
+        if (pids[i] > 0) alive++;
+
+    sigemptyset(&chld); sigaddset(&chld, SIGCHLD);
+
+    while (alive > 0) {
+
+        while ((pid = waitpid(-1, NULL, WNOHANG)) > 0)
+            for (int i = 0; i < k; i++)
+                if (pids[i] == pid) { pids[i] = 0; alive--; }
+
+        if (alive == 0 || (pid == -1 && errno == ECHILD))
+            break;
+
+        if ((now = monotonic_ns()) >= deadline && !killed) {
+
+            for (int i = 0; i < k; i++)
+                if (pids[i] > 0) kill(pids[i], SIGKILL);
+
+            fprintf(stderr, "supervisor: reap: %d server terminati con SIGKILL\n", alive);
+            killed = true;
+        }
+
+        // Un SIGCHLD arrivato dopo la waitpid resta pendente: l'attesa non lo perde.
+        wait = killed || deadline - now > REAP_SLICE_MS * NSEC_PER_MSEC ? REAP_SLICE_MS * NSEC_PER_MSEC : deadline - now;
+        ts.tv_sec = wait / NSEC_PER_SEC; ts.tv_nsec = wait % NSEC_PER_SEC;
+
+        sigtimedwait(&chld, NULL, &ts);
+    }
+}
+
+/**
+ * @function sample
+ * @brief Task periodico: calcola le stime al secondo di ogni server
+ *        nell'ultimo intervallo.
+ */
+static void sample(void* arg) {
+
+    uint64_t now = monotonic_ns(), elapsed = now - lastsample;
+
+    if (elapsed == 0)
+        return;
+
+    for (int i = 0; i < k; i++) {
+
+        unsigned long count = __atomic_load_n(&received[i], __ATOMIC_RELAXED);
+
+        __atomic_store_n(&rate[i], (unsigned long)((count - lastcount[i]) * NSEC_PER_SEC / elapsed), __ATOMIC_RELAXED);
+        lastcount[i] = count;
+    }
+
+    lastsample = now;
+}
+
+/**
+ * @function control_append
+ * @brief Accoda @n byte alla risposta della connessione @c.
+ * @return 0 successo, -1 altrimenti.
+ */
+static int control_append(Control_t* c, const char* data, size_t n) {
+
+    if (c->nout + n > c->size) {
+
+        size_t size = 2 * (c->nout + n); char* tmp;
+
+        NULL_ERR(tmp = realloc(c->out, size), "supervisor: control_append: realloc", return -1)
+        c->out = tmp; c->size = size;
+    }
+
+    memcpy(c->out + c->nout, data, n); c->nout += n;
+    return 0;
+}
+
+/**
+ * @function control_printf
+ * @brief Come control_append, per una riga formattata con @fmt.
+ */
+static int control_printf(Control_t* c, const char* fmt, ...) {
+
+    char line[ESTIMATE_LINE]; va_list args; int n;
+
+    va_start(args, fmt);
+    n = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+
+    return control_append(c, line, n < (int)sizeof(line) ? (size_t)n : sizeof(line) - 1);
+}
+
+/**
+ * @function control_command
+ * @brief Esegue il comando @cmd, accodandone la risposta: una o più righe
+ *        seguite da "END <righe>", oppure "ERR <motivo>" seguita da "END 0".
+ *          TABLE       tutta la tabella, nel formato di SIGINT;
+ *          GET <id>    la riga del client @id (in esadecimale), se presente;
+ *          STATS       contatori del supervisor, uno per riga "STAT <nome> ...".
+ *        La tabella si legge uno shard alla volta con il lock in lettura:
+ *        la ricezione delle stime non si ferma.
+ */
+static void control_command(Control_t* c, char* cmd) {
+
+    char *arg = NULL, *end; int rows = 0;
+
+    if ((end = strchr(cmd, ' ')) != NULL) {
+        *end = '\0'; arg = end + 1; }
+
+    if (strcmp(cmd, "TABLE") == 0) {
+
+        char* buffer; size_t len;
+
+        if ((buffer = format_table(dict, false, false, &len, &rows)) != NULL) {
+            control_append(c, buffer, len); free(buffer); }
+    }
+
+    else if (strcmp(cmd, "GET") == 0 && arg && *arg) {
+
+        long long int id = strtoll(arg, &end, 16); struct value_t value;
+
+        if (*end != '\0') {
+            control_printf(c, "ERR INVALID ID %.32s\n", arg); rows = 0; }
+
+        else if ((value = cdict_get_value(dict, id)).count_server > 0) {
+            control_printf(c, "SUPERVISOR ESTIMATE %d FOR %x BASED ON %d\n", value.miglior_stima, (int)id, value.count_server); rows = 1; }
+    }
+
+    else if (strcmp(cmd, "STATS") == 0) {
+
+        unsigned long total = 0, total_rate = 0; int clients = 0;
+
+        for (int s = 0; s < dict->nshards; s++) {
+
+            pthread_rwlock_rdlock(&dict->shard[s].lock);
+            clients += dict->shard[s].dict->len;
+            pthread_rwlock_unlock(&dict->shard[s].lock);
+        }
+
+        for (int i = 0; i < k; i++) {
+
+            total += __atomic_load_n(&received[i], __ATOMIC_RELAXED);
+            total_rate += __atomic_load_n(&rate[i], __ATOMIC_RELAXED);
+        }
+
+        control_printf(c, "STAT UPTIME_MS %lu\n", (unsigned long)((monotonic_ns() - started) / NSEC_PER_MSEC));
+        control_printf(c, "STAT CLIENTS %d\n", clients);
+        control_printf(c, "STAT ESTIMATES %lu\n", total);
+        control_printf(c, "STAT ESTIMATES_PER_SEC %lu\n", total_rate);
+        control_printf(c, "STAT SERVERS %d\n", k);
+        control_printf(c, "STAT IO_THREADS %d\n", nio);
+        control_printf(c, "STAT WORKERS %d\n", nagg);
+        control_printf(c, "STAT SHARDS %d\n", dict->nshards);
+        rows = 8;
+
+        for (int i = 0; i < k; i++, rows++)
+            control_printf(c, "STAT SERVER %d ESTIMATES %lu ESTIMATES_PER_SEC %lu\n", base + i,
+                           __atomic_load_n(&received[i], __ATOMIC_RELAXED), __atomic_load_n(&rate[i], __ATOMIC_RELAXED));
+    }
 
     else
-		print_request = true;
+        control_printf(c, "ERR UNKNOWN COMMAND %.32s\n", cmd);
+
+    control_printf(c, "END %d\n", rows);
+}
+
+/**
+ * @function control_close
+ * @brief Chiude la connessione @c e libera la sua risposta.
+ */
+static void control_close(Control_t* c) {
+
+    close(c->fd); free(c->out);
+    memset(c, 0, sizeof(Control_t)); c->fd = -1;
+}
+
+/**
+ * @function control_accept
+ * @brief Accetta le connessioni in attesa sul socket di controllo,
+ *        registrandole nella epoll @efd.
+ */
+static void control_accept(int efd) {
+
+    struct epoll_event ev; int fd, i;
+
+    while ((fd = accept(control_fd, NULL, NULL)) != -1) {
+
+        for (i = 0; i < CONTROL_MAX_CONN && control[i].fd != -1; i++);
+
+        if (i == CONTROL_MAX_CONN || fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+            close(fd); continue; }
+
+        ev.events = EPOLLIN; ev.data.u32 = i;
+        MENO1(epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev), "supervisor: control_accept: epoll_ctl", close(fd); continue)
 
-	// Si noti che la funzione time è signal-safe.    
-	lasttime = time(NULL);
+        control[i].fd = fd;
+    }
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        perror("supervisor: control_accept: accept");
 }
 
-static void print_table(Dict_t* dict, FILE* file)  {
+/**
+ * @function control_serve
+ * @brief Legge i comandi della connessione @i e scrive le risposte, senza mai
+ *        bloccarsi: finché una risposta non è stata scritta tutta la connessione
+ *        attende soltanto di poter scrivere, e non si leggono altri comandi.
+ */
+static void control_serve(int efd, int i) {
+
+    Control_t* c = &control[i]; struct epoll_event ev; ssize_t n;
+
+    if (c->off == c->nout) {
+
+        while ((n = read(c->fd, c->in + c->nin, CONTROL_LINE - c->nin)) == -1 && errno == EINTR);
 
-    long long int key; struct value_t value;
+        if (n == 0 || (n == -1 && errno != EAGAIN)) {
+            control_close(c); return; }
 
-    foreach(dict, key, value) {
+        if (n > 0) {
 
-        fprintf(file, "SUPERVISOR ESTIMATE %d FOR %x BASED ON %d\n", value.miglior_stima, (int)key, value.count_server); 
-        fflush(file);
+            char *line = c->in, *nl; c->nin += n;
+
+            while ((nl = memchr(line, '\n', c->in + c->nin - line)) != NULL) {
+
+                *nl = '\0';
+                if (nl > line && nl[-1] == '\r') nl[-1] = '\0';
+
+                control_command(c, line); line = nl + 1;
+            }
+
+            c->nin -= line - c->in; memmove(c->in, line, c->nin);
+
+            // Comando più lungo di CONTROL_LINE: la connessione viene chiusa.
+            if (c->nin == CONTROL_LINE) {
+                control_close(c); return; }
+        }
+    }
+
+    while (c->off < c->nout) {
+
+        if ((n = send(c->fd, c->out + c->off, c->nout - c->off, MSG_NOSIGNAL)) == -1) {
+
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+
+            control_close(c); return;
+        }
+
+        c->off += n;
     }
+
+    if (c->off == c->nout)
+        c->off = c->nout = 0;
+
+    ev.events = c->nout > 0 ? EPOLLOUT : EPOLLIN; ev.data.u32 = i;
+    MENO1(epoll_ctl(efd, EPOLL_CTL_MOD, c->fd, &ev), "supervisor: control_serve: epoll_ctl", control_close(c))
+}
+
+/**
+ * @function control_listen
+ * @brief Crea il socket di controllo in @path e lo registra nella epoll @efd.
+ * @return 0 successo, -1 altrimenti.
+ */
+static int control_listen(int efd, const char* path) {
+
+    Address_t addr; struct epoll_event ev;
+
+    for (int i = 0; i < CONTROL_MAX_CONN; i++)
+        control[i].fd = -1;
+
+    memset(&addr, 0, sizeof(addr)); ADDRESS_INIT(addr, path);
+
+    MENO1(control_fd = socket(AF_UNIX, SOCK_STREAM, 0), "supervisor: control_listen: socket", return -1)
+    MENO1(fcntl(control_fd, F_SETFD, FD_CLOEXEC), "supervisor: control_listen: fcntl", return -1)
+    MENO1(fcntl(control_fd, F_SETFL, O_NONBLOCK), "supervisor: control_listen: fcntl", return -1)
+
+    unlink(path); // Elimino il socket rimasto da esecuzioni precedenti.
+
+    MENO1(bind(control_fd, (struct sockaddr*)&addr, sizeof(addr)), "supervisor: control_listen: bind", return -1)
+    MENO1(listen(control_fd, CONTROL_MAX_CONN), "supervisor: control_listen: listen", return -1)
+
+    ev.events = EPOLLIN; ev.data.u32 = EV_CONTROL;
+    MENO1(epoll_ctl(efd, EPOLL_CTL_ADD, control_fd, &ev), "supervisor: control_listen: epoll_ctl", return -1)
+
+    return 0;
+}
+
+/**
+ * @function default_path
+ * @brief Scrive in @buf il percorso di default @stem@ext, oppure @stem-<base>@ext
+ *        se il primo server non è lo 0: più supervisor sullo stesso host non
+ *        devono condividere archivio e socket di controllo.
+ * @return @buf.
+ */
+static const char* default_path(char* buf, const char* stem, const char* ext) {
+
+    if (base == 0) snprintf(buf, PATH_SIZE, "%s%s", stem, ext);
+    else snprintf(buf, PATH_SIZE, "%s-%d%s", stem, base, ext);
+
+    return buf;
+}
+
+/**
+ * @function collect
+ * @brief Accoda al buffer @arg il record dell'entry @entry di pending;
+ *        se non c'è memoria l'entry torna in pending.
+ */
+static void collect(const Entry_t* entry, void* arg) {
+
+    struct { char* buf; size_t len, size; }* out = arg;
+
+    if (out->len + DELTA_SIZE > out->size) {
+
+        size_t size = out->size ? 2 * out->size : 64 * DELTA_SIZE; char* tmp;
+
+        if ((tmp = realloc(out->buf, size)) == NULL) {
+            cdict_merge(pending, entry->key, entry->value.miglior_stima, entry->value.count_server); return; }
+
+        out->buf = tmp; out->size = size;
+    }
+
+    delta_encode(out->buf + out->len, entry->key, entry->value.miglior_stima, entry->value.count_server);
+    out->len += DELTA_SIZE;
+}
+
+/**
+ * @function root_connect
+ * @return Il socket connesso all'aggregatore, -1 se non è raggiungibile
+ *         (segnalato solo la prima volta).
+ */
+static int root_connect() {
+
+    Address_t addr; int fd;
+
+    memset(&addr, 0, sizeof(addr)); ADDRESS_INIT(addr, root_path);
+
+    MENO1(fd = socket(AF_UNIX, SOCK_STREAM, 0), "supervisor: root_connect: socket", return -1)
+    MENO1(fcntl(fd, F_SETFD, FD_CLOEXEC), "supervisor: root_connect: fcntl", close(fd); return -1)
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+
+        if (!root_warned) perror("supervisor: root_connect: connect");
+        root_warned = true; close(fd); return -1;
+    }
+
+    root_warned = false;
+    return fd;
+}
+
+/**
+ * @function forward
+ * @brief Task periodico: invia all'aggregatore le stime ricevute dall'invio
+ *        precedente, un record per client. Con l'aggregatore non raggiungibile
+ *        le stime restano in pending; i record non scritti per un errore
+ *        tornano in pending, quelli scritti a metà l'aggregatore li scarta.
+ */
+static void forward(void* arg) {
+
+    struct { char* buf; size_t len, size; } out = { NULL, 0, 0 }; size_t off = 0; ssize_t n;
+
+    // Un invio alla volta: se il precedente è ancora in corso questo si salta.
+    if (pthread_mutex_trylock(&forward_lock) != 0)
+        return;
+
+    if (root_fd == -1 && (root_fd = root_connect()) == -1) {
+        pthread_mutex_unlock(&forward_lock); return; }
+
+    cdict_drain(pending, collect, &out);
+
+    while (off < out.len) {
+
+        if ((n = send(root_fd, out.buf + off, out.len - off, MSG_NOSIGNAL)) == -1) {
+
+            if (errno == EINTR) continue;
+
+            perror("supervisor: forward: send");
+            close(root_fd); root_fd = -1; break;
+        }
+
+        off += n;
+    }
+
+    for (off -= off % DELTA_SIZE; off < out.len; off += DELTA_SIZE) {
+
+        int64_t id; int32_t stima, count;
+
+        delta_decode(out.buf + off, &id, &stima, &count);
+        cdict_merge(pending, id, stima, count);
+    }
+
+    free(out.buf);
+    pthread_mutex_unlock(&forward_lock);
+}
+
+/**
+ * @function sweep
+ * @brief Task periodico: rimuove dalla tabella le entry scadute
+ *        o in eccesso, archiviandole.
+ */
+static void sweep(void* arg) {
+
+    cdict_evict(dict, ttl_ms, cap, archive_file ? archive : NULL, archive_file);
+}
+
+/**
+ * @function checkpoint
+ * @brief Task periodico: scrive lo snapshot della tabella.
+ */
+static void checkpoint(void* arg) {
+
+    saveCDict(dict, snapshot);
 }
 
 int main(int argc, char** argv) {
 
-    fd_set set, rdset; FD_ZERO(&set); int fd_max = -1; pids = NULL; pfds = NULL; dict = NULL;
+    int efd, sfd, n, ncpu, ready; char archive_buf[PATH_SIZE], control_buf[PATH_SIZE]; struct epoll_event ev, events[MAX_EVENTS]; sigset_t mask, oldmask, chld;
+    threadpool_attr_t attr; uint64_t one = 1;
+    pids = NULL; pfds = NULL; dict = NULL;
 
     if (argc < 2) {
 
-        fprintf(stderr, "Usage: %s <num-of-server>\n", argv[0]);
+        fprintf(stderr, "Usage: %s <num-of-server> [<first-server-id>]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
     k = (int)stol(argv[1], 10);
 
-    CALLOC(pids, k, sizeof(int), "Supervisor: main: calloc 1", return -1)
+    // Il supervisor gestisce i server da base a base + k - 1: più supervisor
+    // si dividono così gli OOB-server-* a cui si connettono i client.
+    base = argc > 2 ? (int)stol(argv[2], 10) : 0;
+
+    CALLOC(pids, k, sizeof(pid_t), "Supervisor: main: calloc 1", return -1)
     CALLOC(pfds, k, sizeof(int*), "Supervisor: main: calloc 2", return -1)
 
-    memset(&intHandler, 0, sizeof(intHandler));
-    intHandler.sa_handler = sigIntHandler;
-    sigemptyset(&intHandler.sa_mask);
-    sigaction(SIGINT, &intHandler, NULL);
+    if (envtol("OOB_SUPERVISOR_SHM", 0))
+        CALLOC(rings, k, sizeof(ShmRing_t*), "Supervisor: main: calloc 4", return -1)
+
+    CALLOC(partial, k, ESTIMATE_SIZE, "Supervisor: main: calloc 5", return -1)
+    CALLOC(npartial, k, sizeof(int), "Supervisor: main: calloc 6", return -1)
+
+    CALLOC(received, k, sizeof(unsigned long), "Supervisor: main: calloc 7", return -1)
+    CALLOC(rate, k, sizeof(unsigned long), "Supervisor: main: calloc 8", return -1)
+    CALLOC(lastcount, k, sizeof(unsigned long), "Supervisor: main: calloc 9", return -1)
+
+    // SIGINT si riceve tramite signalfd, insieme alle stime: va quindi bloccato
+    // subito, i server ripristinano la maschera prima della exec. Anche SIGCHLD
+    // resta bloccato, per attendere la terminazione dei server con sigtimedwait.
+    sigemptyset(&mask); sigaddset(&mask, SIGINT);
+    sigemptyset(&chld); sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &oldmask);
+    sigprocmask(SIG_BLOCK, &chld, NULL);
+
+    MENO1(efd = epoll_create1(EPOLL_CLOEXEC), "supervisor: main: epoll_create1", return -1)
+    MENO1(sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC), "supervisor: main: signalfd", return -1)
+
+    ev.events = EPOLLIN; ev.data.u32 = EV_SIGNAL;
+    MENO1(epoll_ctl(efd, EPOLL_CTL_ADD, sfd, &ev), "supervisor: main: epoll_ctl", return -1)
+
+    // Lo snapshot è facoltativo: solo con OOB_SUPERVISOR_SNAPSHOT la tabella
+    // si salva lì e, se lo snapshot è valido, riparte da dove era rimasta.
+    if ((snapshot = getenv("OOB_SUPERVISOR_SNAPSHOT")) != NULL && !*snapshot)
+        snapshot = NULL;
+
+    snapshot_ms = envtol("OOB_SUPERVISOR_SNAPSHOT_MS", 5000);
+    print_dirty = envtol("OOB_SUPERVISOR_PRINT_DIRTY", 0) != 0;
+
+    // Thread di I/O (di default uno per CPU, non più dei server) e worker
+    // di aggregazione (uno per CPU); la tabella ha più shard che worker.
+    if ((ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN)) < 1) ncpu = 1;
+
+    nio = (int)envtol("OOB_SUPERVISOR_IO_THREADS", ncpu < k ? ncpu : k);
+    if (nio < 1) nio = 1;
+    if (nio > k) nio = k;
+    if (nio > MAX_THREADS) nio = MAX_THREADS;
+
+    nagg = (int)envtol("OOB_SUPERVISOR_WORKERS", ncpu);
+    if (nagg < 1) nagg = 1;
+    if (nagg > MAX_THREADS) nagg = MAX_THREADS;
+
+    if (snapshot && (dict = loadCDict(snapshot, 4 * nagg)) != NULL) {
 
-    dict = initDict();
+        int len = 0;
+        for (int s = 0; s < dict->nshards; s++) len += dict->shard[s].dict->len;
+
+        printf("SUPERVISOR RESUMING %d CLIENTS\n", len); fflush(stdout);
+    }
+
+    else if (snapshot && errno == EINVAL)
+        fprintf(stderr, "supervisor: main: snapshot %s non valido, ignorato\n", snapshot);
+
+    if (!dict)
+        NULL_ERR(dict = initCDict(4 * nagg), "supervisor: main: initCDict", return -1)
+
+    // Con OOB_SUPERVISOR_ROOT (il socket dell'aggregatore, di solito OOB-aggregator)
+    // le stime vengono anche inviate, come differenze, all'aggregatore radice.
+    if ((root_path = getenv("OOB_SUPERVISOR_ROOT")) != NULL && *root_path)
+        NULL_ERR(pending = initCDict(4 * nagg), "supervisor: main: initCDict", return -1)
+
+    // Con OOB_SUPERVISOR_TTL (ms) e/o OOB_SUPERVISOR_CAP i client inattivi da troppo
+    // tempo, o i meno recenti oltre il limite, escono dalla tabella e la loro stima
+    // finale viene accodata all'archivio OOB_SUPERVISOR_ARCHIVE.
+    ttl_ms = envtol("OOB_SUPERVISOR_TTL", 0); cap = (int)envtol("OOB_SUPERVISOR_CAP", 0);
+
+    if (ttl_ms > 0 || cap > 0) {
+
+        const char* path = getenv("OOB_SUPERVISOR_ARCHIVE");
+        NULL_ERR(archive_file = fopen(path && *path ? path : default_path(archive_buf, "log/supervisor", ".archive"), "ab"), "supervisor: main: fopen", )
+    }
+
+    // Ogni server riceve un insieme di CPU disgiunto da quelli degli altri, preso
+    // nell'ordine compatto in modo da restare su un solo core o nodo NUMA quando
+    // possibile (OOB_SUPERVISOR_AFFINITY=0 per lasciar decidere lo scheduler).
+    if (envtol("OOB_SUPERVISOR_AFFINITY", 1))
+        ncpus = threadpool_cpus(threadpool_affinity_compact, cpus, THREADPOOL_MAX_CPUS);
 
     printf("SUPERVISOR STARTING %d\n", k); fflush(stdout);
 
+    // Creo tutti i canali e avvio tutti i server, senza attenderli uno ad uno.
     for (int i = 0; i < k; i++) {
 
 		CALLOC(pfds[i], 2, sizeof(int), "supervisor: main: calloc 3", return -1)
 
-        MENO1(pipe(pfds[i]), "supervisor: main: pipe", return -1)
+        if (rings) {
 
-        MENO1(pids[i] = fork(), "supervisor: main: fork", return -1)
+            NULL_ERR(rings[i] = shmring_create(SHMRING_SIZE, &pfds[i][1]), "supervisor: main: shmring_create", return -1)
+            MENO1(pfds[i][0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), "supervisor: main: eventfd", return -1)
+        }
 
-        // figlio, server...
-        if (!pids[i]) {
+        else {
 
-            char arg1[16], arg2[16];
-            snprintf(arg1, 16, "%d", i);
-            snprintf(arg2, 16, "%d", pfds[i][1]);
+            MENO1(pipe(pfds[i]), "supervisor: main: pipe", return -1)
+            MENO1(fcntl(pfds[i][0], F_SETFD, FD_CLOEXEC), "supervisor: main: fcntl", return -1)
+        }
 
-            MENO1(close(pfds[i][0]), "server (forked by supervisor): main: close", exit(EXIT_FAILURE))
+        MENO1(spawn(i, &oldmask), "supervisor: main: spawn", return -1)
+    }
 
-            execl("bin/server", "server", arg1, arg2, NULL);
+    // Il thread principale torna su tutte le CPU, dopo essersi legato a quelle di ogni server.
+    if (ncpus > 1)
+        MENO1(threadpool_bind_process(cpus, ncpus), "supervisor: main: threadpool_bind_process", )
 
-            perror("server (forked by supervisor): main: execl");
-            exit(EXIT_FAILURE);
-        }
+    // Ogni server, appena accetta connessioni, lo segnala sul proprio canale.
+    MENO1(ready = await_ready(envtol("OOB_SUPERVISOR_READY_MS", 5000)), "supervisor: main: await_ready", return -1)
+    printf("SUPERVISOR READY %d\n", ready); fflush(stdout);
 
-        // padre, supervisor...
-        close(pfds[i][1]); FD_SET(pfds[i][0], &set);
+    // Avvio il logger asincrono soltanto dopo le fork,
+    // in modo che i figli non ereditino il suo stato.
+    MENO1(logger_init(), "supervisor: main: logger_init", return -1)
 
-        if (pfds[i][0] > fd_max) 
-            fd_max = pfds[i][0];
+    // Avvio la pipeline: prima i worker di aggregazione, poi i thread di I/O.
+    MENO1(stopfd = eventfd(0, EFD_CLOEXEC), "supervisor: main: eventfd", return -1)
+
+    threadpool_attr_init(&attr, nagg, AGG_QUEUE);
+    NULL_ERR(agg = threadpool_create_attr(&attr), "supervisor: main: threadpool_create_attr", return -1)
+
+    threadpool_attr_init(&attr, nio, nio);
+    NULL_ERR(io = threadpool_create_attr(&attr), "supervisor: main: threadpool_create_attr", return -1)
+
+    for (int t = 0; t < nio; t++)
+        MENO1(threadpool_add_wait(io, io_loop, (void*)(intptr_t)t), "supervisor: main: threadpool_add_wait", return -1)
+
+    // Il controllo della scadenza avviene 4 volte per TTL; quello del limite, senza TTL,
+    // ogni CAP_SWEEP_MS. Entrambi, come gli snapshot periodici, girano sui worker.
+    if (ttl_ms > 0 || cap > 0)
+        MENO1(threadpool_schedule_every(agg, ttl_ms > 0 ? (ttl_ms / 4 > 0 ? ttl_ms / 4 : 1) : CAP_SWEEP_MS, sweep, NULL), "supervisor: main: threadpool_schedule_every", )
+
+    if (snapshot && snapshot_ms > 0)
+        MENO1(threadpool_schedule_every(agg, snapshot_ms, checkpoint, NULL), "supervisor: main: threadpool_schedule_every", )
+
+    started = lastsample = monotonic_ns();
+    MENO1(threadpool_schedule_every(agg, STATS_PERIOD_MS, sample, NULL), "supervisor: main: threadpool_schedule_every", )
+
+    if (pending) {
+
+        long forward_ms = envtol("OOB_SUPERVISOR_FORWARD_MS", 1000);
+        MENO1(threadpool_schedule_every(agg, forward_ms > 0 ? forward_ms : 1000, forward, NULL), "supervisor: main: threadpool_schedule_every", )
     }
 
+    // Socket di controllo, di default OOB-supervisor o OOB-supervisor-<base>
+    // (OOB_SUPERVISOR_CONTROL vuota per non crearlo).
+    control_path = getenv("OOB_SUPERVISOR_CONTROL");
+    if (!control_path) control_path = default_path(control_buf, CONTROL_SOCKET, "");
+
+    if (*control_path && control_listen(efd, control_path) == -1) {
+
+        if (control_fd != -1) close(control_fd);
+        control_fd = -1; control_path = NULL;
+    }
+
+    // Il thread principale attende soltanto i segnali e le richieste di controllo.
     while (!stop) {
 
-		rdset = set; struct timeval timeout = {0, 150};
+        if ((n = epoll_wait(efd, events, MAX_EVENTS, -1)) == -1) {
+
+            if (errno == EINTR) continue;
+            perror("supervisor: main: epoll_wait"); break;
+        }
+
+        for (int e = 0; e < n; e++) {
 
-        while (select(fd_max+1, &rdset, NULL, NULL, &timeout) == -1 && errno == EINTR);
+            if (events[e].data.u32 == EV_SIGNAL) on_sigint(sfd);
+            else if (events[e].data.u32 == EV_CONTROL) control_accept(efd);
+            else if (control[events[e].data.u32].fd != -1) control_serve(efd, (int)events[e].data.u32);
+        }
 
         if (print_request) {
 
-            print_table(dict, stderr);
+            print_table(dict, stderr, print_dirty);
             print_request = false;
         }
+    }
 
-        for (int i = 0; i < k; i++) {
+    if (control_fd != -1) {
 
-            if (FD_ISSET(pfds[i][0], &rdset)) {
+        for (int i = 0; i < CONTROL_MAX_CONN; i++)
+            if (control[i].fd != -1) control_close(&control[i]);
 
-                char buffer[64]; char* tmp;
-                MENO1(myread(pfds[i][0], buffer, 64), "supervisor: main: myread", exit(EXIT_FAILURE))
+        close(control_fd); unlink(control_path);
+    }
 
-                long long int ID = atoll(strtok_r(buffer, ",", &tmp));
-                int stima_secret = atoi(strtok_r(NULL, ",", &tmp));
+	// SIGTERM a tutti i server insieme, poi un'unica attesa per tutti. Intanto i thread
+	// di I/O continuano a leggere: i server non restano bloccati sul canale pieno,
+	// e le stime che inviano terminando entrano nella tabella.
+	for (int i = 0; i < k; i++)
+		if (pids[i] > 0) kill(pids[i], SIGTERM);
 
-                printf("SUPERVISOR ESTIMATE %d FOR %x FROM %d\n", stima_secret, (int)ID, i);
-				fflush(stdout);
+	reap(envtol("OOB_SUPERVISOR_KILL_MS", 5000));
 
-                struct value_t value = get_value(dict, ID);
-                
-                if (value.miglior_stima > stima_secret)
-                    value.miglior_stima = stima_secret;
-                
-                value.count_server += 1;
+    // Fermo i thread di I/O, che svuotano i canali fino alla fine,
+    // poi attendo che i worker abbiano aggregato tutti i blocchi ricevuti.
+    MENO1(write(stopfd, &one, sizeof(one)), "supervisor: main: write", )
+    threadpool_destroy(io, threadpool_graceful);
+    threadpool_destroy(agg, threadpool_graceful);
 
-                add(dict, ID, value);
-            }
-        }
+    // Nessuno svuota più i buffer condivisi: un server sopravvissuto non deve attendere spazio.
+    for (int i = 0; rings && i < k; i++)
+        shmring_close(rings[i]);
+
+    // Ultimo invio all'aggregatore, con tutte le stime rimaste.
+    if (pending) {
+
+        forward(NULL);
+        if (root_fd != -1) close(root_fd);
     }
 
-    print_table(dict, stdout);
+    print_table(dict, stdout, false);
+    logger_exit();
+
+    // Lo snapshot finale consente al prossimo avvio di riprendere la tabella.
+    if (snapshot) saveCDict(dict, snapshot);
 
 	for (int i = 0; i < k; i++) {
 
 		close(pfds[i][0]); free(pfds[i]);
-
-		kill(pids[i], SIGTERM);
-
-		waitpid(pids[i], NULL, 0);
+		if (rings) shmring_detach(rings[i]);
 	}
 
     printf("SUPERVISOR EXITING\n");
 
-	deleteDict(dict); free(pfds); free(pids); return 0;
+	if (archive_file)
+		fclose(archive_file);
+
+	close(sfd); close(efd); close(stopfd);
+
+	deleteCDict(dict); if (pending) deleteCDict(pending); free(pfds); free(pids); free(rings); free(partial); free(npartial);
+	free(received); free(rate); free(lastcount); return 0;
 }
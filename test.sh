@@ -26,7 +26,9 @@ else
 	echo Lanciando il supervisor.
 	bin/supervisor 8 >& log/supervisor.txt &
 
-	sleep 2; echo Lanciando 20 clients.
+	# Attendo che tutti i server accettino connessioni.
+	until grep -q "SUPERVISOR READY" log/supervisor.txt 2>/dev/null; do sleep 0.1; done
+	echo Lanciando 20 clients.
 
 	for((i=0; i<20; i+=2)); do
 		bin/client 5 8 20 >& log/client${i}.txt &
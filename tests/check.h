@@ -0,0 +1,38 @@
+/**
+ * @file check.h
+ * @brief Macro comuni ai test di comportamento (make check): ogni test
+ *        è un programma che termina con EXIT_FAILURE al primo controllo
+ *        fallito, indicandone file e riga.
+ *
+ * @author Alessio Bardelli 544270
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore
+ */
+
+#ifndef CHECK_H_
+#define CHECK_H_
+
+#include <utils.h>
+#include <time.h>
+
+// Il messaggio segue la condizione, come gli argomenti di una printf.
+#define CHECK(cond, ...) \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); \
+		exit(EXIT_FAILURE); \
+	}
+
+/**
+ * @function sleep_ms
+ * @brief Sospende il thread per @ms millisecondi.
+ */
+static inline void sleep_ms(long ms) {
+
+	struct timespec ts = { ms / 1000, (ms % 1000) * (long)NSEC_PER_MSEC };
+
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR);
+}
+
+#endif // CHECK_H_
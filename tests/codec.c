@@ -0,0 +1,103 @@
+#define _POSIX_C_SOURCE 200809L
+
+/**
+ * @file codec.c
+ * @brief Test dei record a dimensione fissa scambiati tra i processi:
+ *        le stime dal server al supervisor e le differenze dai supervisor
+ *        all'aggregatore radice.
+ *
+ * @author Alessio Bardelli 544270
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore
+ */
+
+#include <connection.h>
+#include <check.h>
+
+static const int64_t ids[] = { 0, 1, 0x7fffffff, 0x123456789abcLL, INT64_MAX, -2, INT64_MIN };
+static const int32_t values[] = { 0, 1, 1999, INT32_MAX, -1, INT32_MIN };
+
+#define NIDS ((int)(sizeof(ids) / sizeof(ids[0])))
+#define NVALUES ((int)(sizeof(values) / sizeof(values[0])))
+
+/**
+ * @function test_estimate
+ * @brief Ogni record si decodifica nei valori codificati, occupa
+ *        esattamente ESTIMATE_SIZE byte, e un blocco di record consecutivi
+ *        (come quelli di una write del server) si decodifica record per record.
+ */
+static void test_estimate() {
+
+	char buf[ESTIMATE_SIZE + 1], batch[ESTIMATE_BATCH]; int64_t id; int32_t stima; int n = 0;
+
+	for (int i = 0; i < NIDS; i++)
+		for (int j = 0; j < NVALUES; j++) {
+
+			memset(buf, 0x5a, sizeof(buf));
+			estimate_encode(buf, ids[i], values[j]);
+			CHECK(buf[ESTIMATE_SIZE] == 0x5a, "estimate_encode scrive oltre ESTIMATE_SIZE")
+
+			estimate_decode(buf, &id, &stima);
+			CHECK(id == ids[i] && stima == values[j], "record {%lld, %d} decodificato come {%lld, %d}",
+				(long long)ids[i], values[j], (long long)id, stima)
+		}
+
+	// Il primo record del canale: id ESTIMATE_READY, stima l'id del server.
+	estimate_encode(buf, ESTIMATE_READY, 7);
+	estimate_decode(buf, &id, &stima);
+	CHECK(id == ESTIMATE_READY && stima == 7, "ESTIMATE_READY decodificato come {%lld, %d}", (long long)id, stima)
+
+	CHECK(ESTIMATE_BATCH % ESTIMATE_SIZE == 0 && ESTIMATE_BATCH <= PIPE_BUF, "un blocco non è fatto di record interi entro PIPE_BUF")
+
+	for (n = 0; (n + 1) * ESTIMATE_SIZE <= ESTIMATE_BATCH; n++)
+		estimate_encode(batch + n * ESTIMATE_SIZE, ids[n % NIDS], values[n % NVALUES]);
+
+	for (int r = 0; r < n; r++) {
+
+		estimate_decode(batch + r * ESTIMATE_SIZE, &id, &stima);
+		CHECK(id == ids[r % NIDS] && stima == values[r % NVALUES], "record %d del blocco", r)
+	}
+}
+
+/**
+ * @function test_delta
+ * @brief Il record di una differenza ha un formato fisso in network byte
+ *        order, indipendente dalla macchina, e si decodifica nei valori codificati.
+ */
+static void test_delta() {
+
+	const unsigned char expected[DELTA_SIZE] = {
+		0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,     // id
+		0x0a, 0x0b, 0x0c, 0x0d,                             // stima minima
+		0x11, 0x12, 0x13, 0x14                              // numero di stime
+	};
+	char buf[DELTA_SIZE + 1]; int64_t id; int32_t stima, count;
+
+	memset(buf, 0x5a, sizeof(buf));
+	delta_encode(buf, 0x0102030405060708LL, 0x0a0b0c0d, 0x11121314);
+
+	CHECK(memcmp(buf, expected, DELTA_SIZE) == 0, "il record non è in network byte order")
+	CHECK(buf[DELTA_SIZE] == 0x5a, "delta_encode scrive oltre DELTA_SIZE")
+
+	for (int i = 0; i < NIDS; i++)
+		for (int j = 0; j < NVALUES; j++) {
+
+			int32_t n = values[(j + 1) % NVALUES];
+
+			delta_encode(buf, ids[i], values[j], n);
+			delta_decode(buf, &id, &stima, &count);
+
+			CHECK(id == ids[i] && stima == values[j] && count == n, "record {%lld, %d, %d} decodificato come {%lld, %d, %d}",
+				(long long)ids[i], values[j], n, (long long)id, stima, count)
+		}
+}
+
+int main() {
+
+	test_estimate();
+	test_delta();
+
+	printf("codec: OK\n");
+	return 0;
+}
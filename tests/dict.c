@@ -0,0 +1,287 @@
+#define _POSIX_C_SOURCE 200809L
+
+/**
+ * @file dict.c
+ * @brief Test del dizionario: inserimenti e aggiornamenti attraverso
+ *        i raddoppi dell'indice, rimozioni e reinserimenti, ordine
+ *        dell'eviction, snapshot e riconoscimento di quelli corrotti.
+ *
+ * @author Alessio Bardelli 544270
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore
+ */
+
+#include <dict.h>
+#include <check.h>
+#include <fcntl.h>
+#include <stddef.h>
+
+#define NKEYS 100000 // Abbastanza chiavi da raddoppiare più volte l'indice.
+
+// Chiavi sparse, anche negative, come gli id dei client.
+static long long int key_of(int i) { return (long long int)i * 2654435761LL - NKEYS; }
+
+/**
+ * @function test_insert
+ * @brief Ogni chiave inserita si ritrova con il suo valore dopo tutti
+ *        i rehash; merge tiene il minimo e somma i conteggi.
+ */
+static void test_insert() {
+
+	Dict_t* dict; struct value_t v;
+
+	NULL_ERR(dict = initDict(), "dict: test_insert: initDict", exit(EXIT_FAILURE))
+
+	for (int i = 0; i < NKEYS; i++)
+		add(dict, key_of(i), (struct value_t){ i % 1000 + 10, 1 });
+
+	CHECK(dict->len == NKEYS, "len %d invece di %d", dict->len, NKEYS)
+
+	for (int i = 0; i < NKEYS; i++) {
+
+		v = get_value(dict, key_of(i));
+		CHECK(v.miglior_stima == i % 1000 + 10 && v.count_server == 1, "chiave %d: {%d, %d}", i, v.miglior_stima, v.count_server)
+	}
+
+	v = get_value(dict, key_of(NKEYS));
+	CHECK(v.miglior_stima == INT_MAX && v.count_server == 0, "chiave assente: {%d, %d}", v.miglior_stima, v.count_server)
+
+	// Una stima peggiore non cambia il minimo, una migliore sì; i conteggi si sommano.
+	v = merge(dict, key_of(7), 5000, 2);
+	CHECK(v.miglior_stima == 17 && v.count_server == 3, "merge peggiore: {%d, %d}", v.miglior_stima, v.count_server)
+
+	v = merge(dict, key_of(7), 3, 1);
+	CHECK(v.miglior_stima == 3 && v.count_server == 4, "merge migliore: {%d, %d}", v.miglior_stima, v.count_server)
+
+	v = merge(dict, key_of(NKEYS), 42, 5);
+	CHECK(v.miglior_stima == 42 && v.count_server == 5 && dict->len == NKEYS + 1, "merge di una chiave nuova")
+
+	// add sostituisce il valore.
+	add(dict, key_of(7), (struct value_t){ 99, 9 });
+	v = get_value(dict, key_of(7));
+	CHECK(v.miglior_stima == 99 && v.count_server == 9 && dict->len == NKEYS + 1, "add di una chiave presente")
+
+	deleteDict(dict);
+}
+
+/**
+ * @function test_remove
+ * @brief Dopo aver rimosso la maggior parte delle chiavi (con il
+ *        conseguente restringimento dell'indice) le rimaste si ritrovano,
+ *        le rimosse no, e si possono reinserire.
+ */
+static void test_remove() {
+
+	Dict_t* dict; struct value_t v; int removed;
+
+	NULL_ERR(dict = initDict(), "dict: test_remove: initDict", exit(EXIT_FAILURE))
+
+	for (int i = 0; i < NKEYS; i++)
+		add(dict, key_of(i), (struct value_t){ i, 1 });
+
+	// Le prime metà delle chiavi risultano aggiornate molto tempo fa: il ttl le rimuove.
+	for (int i = 0; i < dict->len; i++)
+		if (get_value(dict, dict->entry[i].key).miglior_stima < NKEYS / 2)
+			dict->entry[i].last -= 60000;
+
+	removed = evict(dict, 30000, 0, NULL, NULL);
+	CHECK(removed == NKEYS / 2 && dict->len == NKEYS / 2, "rimosse %d, restano %d", removed, dict->len)
+
+	for (int i = 0; i < NKEYS; i++) {
+
+		v = get_value(dict, key_of(i));
+
+		if (i < NKEYS / 2) {
+			CHECK(v.count_server == 0, "la chiave rimossa %d è ancora presente", i) }
+
+		else {
+			CHECK(v.miglior_stima == i && v.count_server == 1, "chiave %d: {%d, %d}", i, v.miglior_stima, v.count_server) }
+	}
+
+	// I reinserimenti riusano gli slot cancellati senza confondere le chiavi.
+	for (int i = 0; i < NKEYS / 2; i++)
+		add(dict, key_of(i), (struct value_t){ -i, 2 });
+
+	CHECK(dict->len == NKEYS, "len %d dopo i reinserimenti", dict->len)
+
+	for (int i = 0; i < NKEYS; i++) {
+
+		v = get_value(dict, key_of(i));
+		CHECK(v.miglior_stima == (i < NKEYS / 2 ? -i : i), "chiave %d: stima %d dopo i reinserimenti", i, v.miglior_stima)
+	}
+
+	deleteDict(dict);
+}
+
+/**
+ * @function archived
+ * @brief Funzione di archiviazione di test_evict: annota le chiavi rimosse.
+ */
+static void archived(const Entry_t* entry, void* arg) {
+
+	int* seen = arg;
+
+	seen[entry->key]++;
+}
+
+/**
+ * @function test_evict
+ * @brief Oltre il limite si rimuovono le entry meno recenti, fino a 7/8
+ *        del limite, passandole prima alla funzione di archiviazione;
+ *        a parità di istante se ne rimuovono solo quante ne servono.
+ */
+static void test_evict() {
+
+	Dict_t* dict; int seen[32] = { 0 }, removed, ties = 0; uint64_t base = monotonic_ns() / NSEC_PER_MSEC;
+
+	NULL_ERR(dict = initDict(), "dict: test_evict: initDict", exit(EXIT_FAILURE))
+
+	// La chiave k risulta aggiornata all'istante base - 100 + k: la 0 è la meno recente.
+	for (int k = 0; k < 16; k++)
+		add(dict, k, (struct value_t){ k, 1 });
+
+	for (int i = 0; i < dict->len; i++)
+		dict->entry[i].last = base - 100 + dict->entry[i].key;
+
+	// 16 entry con limite 8: si scende a 7, rimuovendo le 9 meno recenti.
+	removed = evict(dict, 0, 8, archived, seen);
+	CHECK(removed == 9 && dict->len == 7, "rimosse %d, restano %d", removed, dict->len)
+
+	for (int k = 0; k < 16; k++) {
+
+		CHECK(seen[k] == (k < 9), "chiave %d archiviata %d volte", k, seen[k])
+		CHECK((get_value(dict, k).count_server == 0) == (k < 9), "chiave %d %s", k, k < 9 ? "non rimossa" : "rimossa")
+	}
+
+	// Entro il limite non si rimuove nulla.
+	CHECK(evict(dict, 0, 8, archived, seen) == 0, "eviction entro il limite")
+
+	// A parità di istante: 16 + 7 entry, le 16 nuove tutte aggiornate all'istante base - 200.
+	for (int k = 16; k < 32; k++)
+		add(dict, k, (struct value_t){ k, 1 });
+
+	for (int i = 0; i < dict->len; i++)
+		if (dict->entry[i].key >= 16) dict->entry[i].last = base - 200;
+
+	removed = evict(dict, 0, 16, archived, seen);
+	CHECK(removed == 23 - 14 && dict->len == 14, "rimosse %d, restano %d", removed, dict->len)
+
+	for (int k = 16; k < 32; k++)
+		ties += seen[k];
+
+	CHECK(ties == 9, "rimosse %d entry a pari istante invece di 9", ties)
+
+	for (int k = 9; k < 16; k++)
+		CHECK(get_value(dict, k).count_server == 1, "la chiave %d, più recente, è stata rimossa", k)
+
+	deleteDict(dict);
+}
+
+/**
+ * @function corrupt
+ * @brief Copia lo snapshot @src in @dst, invertendo i bit del byte in
+ *        posizione @off (nessuno se negativa) e troncandolo a @len byte.
+ */
+static void corrupt(const char* src, const char* dst, long off, long len) {
+
+	char* buf = NULL; int fd; long n;
+
+	CALLOC(buf, len, 1, "dict: corrupt: calloc", exit(EXIT_FAILURE))
+	MENO1(fd = open(src, O_RDONLY), "dict: corrupt: open", exit(EXIT_FAILURE))
+	MENO1(n = read(fd, buf, len), "dict: corrupt: read", exit(EXIT_FAILURE))
+	close(fd);
+
+	if (off >= 0 && off < n) buf[off] ^= 0xff;
+
+	MENO1(fd = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0600), "dict: corrupt: open", exit(EXIT_FAILURE))
+	MENO1(write(fd, buf, n), "dict: corrupt: write", exit(EXIT_FAILURE))
+	close(fd); free(buf);
+}
+
+/**
+ * @function test_snapshot
+ * @brief Uno snapshot riletto contiene le stesse entry, anche ripartite
+ *        in un numero diverso di shard; uno snapshot alterato o troncato
+ *        viene rifiutato con EINVAL, uno assente con ENOENT.
+ */
+static void test_snapshot() {
+
+	char path[64], bad[64]; Dict_t *dict, *copy; CDict_t* cdict; struct value_t v; long size;
+	size_t header = sizeof(DictSnapshot_t), entries;
+
+	snprintf(path, sizeof(path), "/tmp/oob-check-%d.snapshot", (int)getpid());
+	snprintf(bad, sizeof(bad), "/tmp/oob-check-%d.bad", (int)getpid());
+
+	NULL_ERR(dict = initDict(), "dict: test_snapshot: initDict", exit(EXIT_FAILURE))
+
+	for (int i = 0; i < 1000; i++)
+		add(dict, key_of(i), (struct value_t){ i, i % 7 + 1 });
+
+	CHECK(saveDict(dict, path) == 0, "saveDict")
+
+	NULL_ERR(copy = loadDict(path), "dict: test_snapshot: loadDict", exit(EXIT_FAILURE))
+	CHECK(copy->len == dict->len, "len %d invece di %d", copy->len, dict->len)
+
+	for (int i = 0; i < 1000; i++) {
+
+		v = get_value(copy, key_of(i));
+		CHECK(v.miglior_stima == i && v.count_server == i % 7 + 1, "chiave %d: {%d, %d}", i, v.miglior_stima, v.count_server)
+	}
+
+	CHECK(copy->ndirty == 0, "entry modificate dopo il caricamento")
+	deleteDict(copy);
+
+	// Lo snapshot di un dizionario concorrente si riparte in un numero qualunque di shard.
+	NULL_ERR(cdict = loadCDict(path, 4), "dict: test_snapshot: loadCDict", exit(EXIT_FAILURE))
+	CHECK(saveCDict(cdict, path) == 0, "saveCDict")
+	deleteCDict(cdict);
+
+	NULL_ERR(cdict = loadCDict(path, 16), "dict: test_snapshot: loadCDict", exit(EXIT_FAILURE))
+
+	for (int i = 0; i < 1000; i++) {
+
+		v = cdict_get_value(cdict, key_of(i));
+		CHECK(v.miglior_stima == i && v.count_server == i % 7 + 1, "chiave %d dopo saveCDict: {%d, %d}", i, v.miglior_stima, v.count_server)
+	}
+
+	deleteCDict(cdict);
+
+	entries = (size_t)dict->len * sizeof(Entry_t); size = (long)(header + entries);
+
+	// Un bit alterato nelle entry, nell'intestazione o nel numero di entry, e un file troncato.
+	long offsets[] = { (long)(header + entries / 2), 0, (long)offsetof(DictSnapshot_t, version), (long)offsetof(DictSnapshot_t, len), size - 1 };
+
+	for (int i = 0; i < (int)(sizeof(offsets) / sizeof(offsets[0])); i++) {
+
+		corrupt(path, bad, offsets[i], size);
+		errno = 0;
+		CHECK(loadDict(bad) == NULL && errno == EINVAL, "snapshot alterato al byte %ld accettato", offsets[i])
+	}
+
+	corrupt(path, bad, -1, size - (long)sizeof(Entry_t));
+	errno = 0;
+	CHECK(loadDict(bad) == NULL && errno == EINVAL, "snapshot troncato accettato")
+
+	corrupt(path, bad, -1, 4);
+	errno = 0;
+	CHECK(loadDict(bad) == NULL && errno == EINVAL, "snapshot più corto dell'intestazione accettato")
+
+	unlink(bad); unlink(path);
+
+	errno = 0;
+	CHECK(loadDict(path) == NULL && errno == ENOENT, "snapshot assente: errno %d", errno)
+
+	deleteDict(dict);
+}
+
+int main() {
+
+	test_insert();
+	test_remove();
+	test_evict();
+	test_snapshot();
+
+	printf("dict: OK\n");
+	return 0;
+}
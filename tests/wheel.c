@@ -0,0 +1,121 @@
+#define _POSIX_C_SOURCE 200809L
+
+/**
+ * @file wheel.c
+ * @brief Test della ruota dei timer del threadpool: un timer singolo non
+ *        scade prima del suo ritardo (e non troppo dopo), uno periodico
+ *        scade una volta per periodo finché non viene cancellato, un timer
+ *        cancellato non scade e i ritardi oltre il primo livello della ruota
+ *        attraversano correttamente i livelli superiori.
+ *
+ * @author Alessio Bardelli 544270
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore
+ */
+
+#include <threadpool.h>
+#include <check.h>
+
+#define SLACK_MS 100 // Ritardo massimo tollerato di una scadenza (CPU condivisa).
+
+static uint64_t start;
+static long fired[8];
+static int ticks = 0;
+
+static long elapsed_ms() { return (long)((monotonic_ns() - start) / NSEC_PER_MSEC); }
+
+static void at(void* arg) { __atomic_store_n(&fired[(intptr_t)arg], elapsed_ms(), __ATOMIC_SEQ_CST); }
+
+static void every(void* arg) { __atomic_add_fetch(&ticks, 1, __ATOMIC_SEQ_CST); }
+
+/**
+ * @function test_delay
+ * @brief Timer singoli sul primo livello, a cavallo della fine del suo giro
+ *        (64 tick) e sui livelli superiori.
+ */
+static void test_delay(threadpool_t* pool) {
+
+	long delay[] = { 1, 40, 70, 300, 4100 }; int n = sizeof(delay) / sizeof(delay[0]);
+
+	start = monotonic_ns();
+
+	for (int i = 0; i < n; i++) {
+		fired[i] = -1; CHECK(threadpool_schedule_after(pool, delay[i], at, (void*)(intptr_t)i) > 0, "schedule_after %ld", delay[i]) }
+
+	sleep_ms(delay[n - 1] + SLACK_MS);
+
+	// Il tick è di 1 ms: una scadenza può anticipare al più di un tick.
+	for (int i = 0; i < n; i++) {
+
+		long got = __atomic_load_n(&fired[i], __ATOMIC_SEQ_CST);
+
+		CHECK(got != -1, "il timer di %ld ms non è scaduto", delay[i])
+		CHECK(got >= delay[i] - 1 && got <= delay[i] + SLACK_MS, "il timer di %ld ms è scaduto dopo %ld ms", delay[i], got)
+	}
+}
+
+/**
+ * @function test_periodic
+ * @brief Un timer periodico scade circa una volta per periodo e,
+ *        cancellato, al più un'ultima volta (se già sottomesso).
+ */
+static void test_periodic(threadpool_t* pool) {
+
+	long id; int count;
+
+	ticks = 0;
+	CHECK((id = threadpool_schedule_every(pool, 20, every, NULL)) > 0, "schedule_every")
+
+	sleep_ms(500);
+	CHECK(threadpool_cancel(pool, id) == 0, "cancel del timer periodico")
+
+	count = __atomic_load_n(&ticks, __ATOMIC_SEQ_CST);
+	CHECK(count >= 500 / 20 - 5 && count <= 500 / 20 + 1, "%d esecuzioni in 500 ms con periodo 20 ms", count)
+
+	sleep_ms(100);
+	CHECK(__atomic_load_n(&ticks, __ATOMIC_SEQ_CST) <= count + 1, "il timer periodico continua dopo la cancel")
+
+	CHECK(threadpool_cancel(pool, id) == -1 && errno == ENOENT, "seconda cancel dello stesso timer")
+}
+
+/**
+ * @function test_cancel
+ * @brief Un timer cancellato prima della scadenza non viene eseguito,
+ *        uno già scaduto non si può più cancellare.
+ */
+static void test_cancel(threadpool_t* pool) {
+
+	long id, done;
+
+	start = monotonic_ns(); fired[0] = fired[1] = -1;
+
+	CHECK((id = threadpool_schedule_after(pool, 50, at, (void*)0)) > 0, "schedule_after")
+	CHECK((done = threadpool_schedule_after(pool, 10, at, (void*)1)) > 0, "schedule_after")
+	CHECK(threadpool_cancel(pool, id) == 0, "cancel prima della scadenza")
+
+	sleep_ms(100 + SLACK_MS);
+
+	CHECK(__atomic_load_n(&fired[0], __ATOMIC_SEQ_CST) == -1, "il timer cancellato è scaduto")
+	CHECK(__atomic_load_n(&fired[1], __ATOMIC_SEQ_CST) != -1, "il timer non cancellato non è scaduto")
+	CHECK(threadpool_cancel(pool, done) == -1 && errno == ENOENT, "cancel di un timer già scaduto")
+
+	CHECK(threadpool_schedule_after(pool, -1, at, NULL) == -1 && errno == EINVAL, "ritardo negativo")
+	CHECK(threadpool_schedule_every(pool, 0, every, NULL) == -1 && errno == EINVAL, "periodo nullo")
+}
+
+int main() {
+
+	threadpool_t* pool;
+
+	NULL_ERR(pool = threadpool_create(2, 64), "wheel: main: threadpool_create", exit(EXIT_FAILURE))
+
+	test_delay(pool);
+	test_periodic(pool);
+	test_cancel(pool);
+
+	threadpool_destroy(pool, 0);
+
+	printf("wheel: OK\n");
+	return 0;
+}